@@ -0,0 +1,126 @@
+#include <string.h>
+#include <math.h>
+#include "histogram.h"
+
+/**
+ * Empties a histogram.
+ * @param h: histogram
+*/
+void histogram_init(histogram *h) {
+    memset(h, 0, sizeof(histogram));
+}
+
+/**
+ * Finds the bucket of a value.
+ * @param value: value, not negative
+*/
+static int histogram_bucket(long value) {
+    int shift;
+
+    if (value < HISTOGRAM_SUB)
+        return value;
+    /* value >> shift is in [HISTOGRAM_SUB / 2, HISTOGRAM_SUB) */
+    shift = 63 - __builtin_clzl(value) - (HISTOGRAM_SUB_BITS - 1);
+    return shift * (HISTOGRAM_SUB / 2) + (value >> shift);
+}
+
+/**
+ * Returns the highest value counted in a bucket.
+ * @param bucket: bucket
+*/
+static long histogram_value(int bucket) {
+    int shift;
+
+    if (bucket < HISTOGRAM_SUB)
+        return bucket;
+    shift = bucket / (HISTOGRAM_SUB / 2) - 1;
+    return ((long) (bucket - shift * (HISTOGRAM_SUB / 2) + 1) << shift) - 1;
+}
+
+/**
+ * Counts a value.
+ * @param h: histogram
+ * @param value: value, negative values are counted as 0
+*/
+void histogram_record(histogram *h, long value) {
+    if (value < 0)
+        value = 0;
+    h->counts[histogram_bucket(value)]++;
+    h->total++;
+    if (value > h->max)
+        h->max = value;
+}
+
+/**
+ * Adds the values of a histogram to another.
+ * @param into: histogram that receives the values
+ * @param from: histogram added
+*/
+void histogram_merge(histogram *into, histogram *from) {
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+        into->counts[i] += from->counts[i];
+    into->total += from->total;
+    if (from->max > into->max)
+        into->max = from->max;
+}
+
+/**
+ * Returns the value below which a percentage of the values fall, rounded
+ * up to the highest value of its bucket.
+ * @param h: histogram
+ * @param percentile: percentage, from 0 to 100
+ * @return value, or 0 if the histogram is empty
+*/
+long histogram_percentile(histogram *h, double percentile) {
+    long rank, seen = 0;
+
+    if (h->total == 0)
+        return 0;
+    rank = (long) (percentile / 100 * h->total + 0.5);
+    if (rank < 1)
+        rank = 1;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank)
+            return histogram_value(i) < h->max ? histogram_value(i) : h->max;
+    }
+    return h->max;
+}
+
+/**
+ * Prints the distribution of a histogram in the percentile format of
+ * HdrHistogram (.hgrm), read by its plotting tools: one line for every
+ * bucket with values, with the percentage of values up to it.
+ * @param out: file
+ * @param h: histogram
+ * @param scale: divisor of the values printed, e.g. 1000 for microseconds
+*/
+void histogram_print(FILE *out, histogram *h, double scale) {
+    long seen = 0;
+    double sum = 0, squares = 0, mean = 0, variance = 0;
+
+    fprintf(out, "%12s %14s %10s %14s\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+    for (int i = 0; i < HISTOGRAM_BUCKETS && seen < h->total; i++) {
+        double value, fraction;
+
+        if (h->counts[i] == 0)
+            continue;
+        seen += h->counts[i];
+        value = (histogram_value(i) < h->max ? histogram_value(i) : h->max) / scale;
+        fraction = (double) seen / h->total;
+        sum += value * h->counts[i];
+        squares += value * value * h->counts[i];
+        if (seen < h->total)
+            fprintf(out, "%12.3f %14.12f %10ld %14.2f\n", value, fraction, seen, 1 / (1 - fraction));
+        else
+            fprintf(out, "%12.3f %14.12f %10ld\n", value, fraction, seen);
+    }
+
+    if (h->total > 0) {
+        mean = sum / h->total;
+        variance = squares / h->total - mean * mean;
+    }
+    fprintf(out, "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n", mean, variance > 0 ? sqrt(variance) : 0.0);
+    fprintf(out, "#[Max     = %12.3f, Total count    = %12ld]\n", h->max / scale, h->total);
+    fprintf(out, "#[Buckets = %12d, SubBuckets     = %12d]\n", HISTOGRAM_BUCKETS, HISTOGRAM_SUB);
+}
@@ -0,0 +1,27 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdio.h>
+
+/*
+ * Log-linear histogram of latencies in nanoseconds: values under
+ * HISTOGRAM_SUB are counted exactly, and every power of two above is split
+ * in HISTOGRAM_SUB / 2 buckets, so each value is kept within 1/64 (1.6%)
+ */
+#define HISTOGRAM_SUB_BITS 7
+#define HISTOGRAM_SUB (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) * (HISTOGRAM_SUB / 2))
+
+typedef struct histogram {
+    long counts[HISTOGRAM_BUCKETS];
+    long total;
+    long max;
+} histogram;
+
+void histogram_init(histogram *h);
+void histogram_record(histogram *h, long value);
+void histogram_merge(histogram *into, histogram *from);
+long histogram_percentile(histogram *h, double percentile);
+void histogram_print(FILE *out, histogram *h, double scale);
+
+#endif /* HISTOGRAM_H */
@@ -1,14 +1,99 @@
 #include "tecnicofs-client-api.h"
+#include "../tecnicofs-protocol.h"
+#include "../tecnicofs-shm.h"
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sched.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
+#include <time.h>
 
-int client_sockfd;
-char* client_socket_name;
-extern char* serverName;
+/* largest request with up to two paths, followed by the id of the lease owner */
+#define MAX_REQUEST_SIZE (sizeof(tfs_header) + 2 * MAX_FILE_NAME + sizeof(uint32_t))
+
+/*
+ * Reply received before its request was waited for, or request waiting for
+ * its reply
+ */
+typedef struct reply_entry {
+  uint32_t request_id;
+  int32_t result;
+  int used;               //reserved by a request whose result was not taken yet
+  int ready;
+  int async;              //issued by an asynchronous call that was not completed yet
+  tfs_callback callback;
+  void *arg;
+  int *results;           //where the results of a batch are copied
+  char *payload;          //where the entries of a readdir or the attributes of a stat are copied
+  uint32_t lease;         //microseconds the server leased the result of a lookup, 0 if not
+  int mutation;           //delete, move, transaction or batch waiting for its reply
+} reply_entry;
+
+/*
+ * Lookup answered by the server with a lease, which may be answered again
+ * from the cache until the lease expires
+ */
+typedef struct cache_entry {
+  char path[MAX_FILE_NAME];   //empty if the entry is free
+  int inumber;
+  long expiry;                //nanoseconds of the monotonic clock
+} cache_entry;
+
+/*
+ * Creates and deletes buffered by the write-behind mode, sent as a batch
+ */
+typedef struct deferred_batch {
+  tfs_batch batch;
+  char paths[MAX_TRANSACTION_OPS][MAX_FILE_NAME];  //path of each operation
+  int results[MAX_TRANSACTION_OPS];
+  uint32_t id;                                     //of the request while it waits for its reply, else 0
+} deferred_batch;
+
+struct tfs_session {
+  int sockfd;
+  int number;                            //distinguishes the sessions of the process
+  char socket_name[MAX_SOCKET_NAME];     //bound by a datagram socket
+  struct sockaddr_un serv_addr;
+  socklen_t servlen;
+  int connected;                         //set if the server accepted a connection (SOCK_SEQPACKET)
+  shm_segment *shared;                   //segment shared with the server, if negotiated
+  int shared_spin;
+  pthread_mutex_t lock;                  //protects the fields below
+  pthread_cond_t replied;                //broadcast when a reply is stashed or an entry is freed
+  int receiving;                         //a thread is taking replies, the others wait for it
+  uint32_t request_id;                   //id of the last request sent
+  int in_use;                            //entries of the stash reserved
+  reply_entry stash[MAX_PENDING];        //indexed by request id
+  int async_pending;                     //asynchronous requests not completed yet
+  int async_ready;                       //asynchronous requests whose reply arrived
+  uint32_t completed[MAX_PENDING];       //asynchronous requests with a callback to call, in order
+  int completed_head, completed_count;
+  int async_eventfd;                     //signaled when an asynchronous request completes
+  int async_epfd;                        //readable when there are replies to take (tfsAsyncFd)
+  uint32_t owner;                        //identifies the leases of the session to the server
+  unsigned mutations;                    //deletes, moves, transactions and batches sent
+  int mutating;                          //of those, the ones waiting for their reply
+  cache_entry cache[LOOKUP_CACHE_SLOTS]; //indexed by the hash of the path
+  pthread_mutex_t deferred_lock;         //protects the fields below, taken before lock
+  int deferred_max;                      //operations per batch in write-behind mode, 0 if disabled
+  deferred_batch *filling;               //operations buffered
+  deferred_batch *flushed;               //batch sent, until its reply is taken
+  int deferred_failed;                   //operations that failed since the last tfsSync
+};
+
+tfs_session *default_session = NULL;  //session of the calls without one, opened by tfsMount
+int sessions = 0;                     //sessions opened by the process
 
 /**
  * Resets and set socket address.
@@ -30,173 +115,1561 @@ int setSockAddrUn(char *path, struct sockaddr_un *addr) {
 }
 
 /**
- * Creates socket name based on a standart name plus the pid of the client.
+ * Creates socket name based on a standart name plus the pid of the client
+ * and the number of the session.
+ * @param session: session
+*/
+void createSocketName(tfs_session *session) {
+  sprintf(session->socket_name, "%s%d-%d", CLIENT_SOCKET_NAME, getpid(), session->number);
+}
+
+/**
+ * Reserves the entry of the stash of a new request, waiting while every
+ * entry is reserved. Ids stay positive, as they are the tickets of the
+ * asynchronous calls, and skip the entries reserved by other requests.
+ * Called with the lock of the session held.
+ * @param session: session
+ * @param request: fields of the entry (asynchronous call and batch), or NULL
+ * @return id of the request
 */
-void createSocketName(){
-  
-  char pid_string[MAX_FILE_NAME];
-  char socket_name[MAX_SOCKET_NAME];
+uint32_t reserveEntry(tfs_session *session, reply_entry *request) {
 
-  /* converts pid from int to string */
-  sprintf(pid_string,"%d",getpid());
+  reply_entry *entry;
 
-  strcpy(socket_name,CLIENT_SOCKET_NAME);
+  while (session->in_use == MAX_PENDING)
+    pthread_cond_wait(&session->replied, &session->lock);
+  do
+    session->request_id = session->request_id % INT32_MAX + 1;
+  while (session->stash[session->request_id % MAX_PENDING].used);
 
-  /* concatenate socket_name and pid_string to create unique name */
-  strcpy(client_socket_name,strcat(socket_name,pid_string));
+  entry = &session->stash[session->request_id % MAX_PENDING];
+  if (request != NULL)
+    *entry = *request;
+  else
+    memset(entry, 0, sizeof(reply_entry));
+  entry->request_id = session->request_id;
+  entry->used = 1;
+  entry->ready = 0;
+  entry->mutation = 0;
+  session->in_use++;
+  return session->request_id;
 }
 
+/**
+ * Frees the entry of a request whose result was taken.
+ * Called with the lock of the session held.
+ * @param session: session
+ * @param entry: entry of the request
+*/
+void freeEntry(tfs_session *session, reply_entry *entry) {
+  if (entry->mutation)
+    session->mutating--;
+  entry->mutation = 0;
+  entry->used = 0;
+  entry->ready = 0;
+  entry->async = 0;
+  if (session->in_use-- == MAX_PENDING)
+    pthread_cond_broadcast(&session->replied);
+}
 
-int tfsCreate(char *filename, char nodeType) {
+/**
+ * Encodes a request of the binary format, each path followed by a '\0'. The
+ * id of the request, and that of the lease owner with TFS_FLAG_LEASE, are
+ * only set when it is sent.
+ * @param buffer: where the request is written
+ * @param available: size of the buffer
+ * @param opcode: operation
+ * @param flags: flags of the operation
+ * @param path: first path
+ * @param dest: second path (move only) or NULL
+ * @return size of the request or TECNICOFS_ERROR_OTHER if it does not fit
+*/
+int encodeRequest(char *buffer, int available, uint8_t opcode, uint8_t flags, char *path, char *dest) {
 
-  int servlen,result;
-  char buffer[MAX_INPUT_SIZE];
-  struct sockaddr_un serv_addr;
+  tfs_header header;
+  char *paths[2] = { path, dest };
+  int size = sizeof(tfs_header);
 
-  sprintf(buffer,"c %s %c",filename,nodeType);
-  servlen = setSockAddrUn(serverName, &serv_addr);
+  header.magic = TFS_MAGIC;
+  header.version = TFS_VERSION;
+  header.opcode = opcode;
+  header.flags = flags;
+  header.request_id = 0;
+  header.length[0] = header.length[1] = 0;
 
-  /* sends command to serv_addr */
-  if (sendto(client_sockfd, buffer, strlen(buffer)+1, 0, (struct sockaddr *) &serv_addr, servlen) < 0) {
-    perror("client: sendto error");
-    exit(EXIT_FAILURE);
-  } 
+  for (int i = 0; i < 2 && paths[i] != NULL; i++) {
+    int len = strlen(paths[i]);
+    if (len >= MAX_FILE_NAME || size + len + 1 > available)
+      return TECNICOFS_ERROR_OTHER;
+    header.length[i] = len;
+    memcpy(buffer + size, paths[i], len + 1);
+    size += len + 1;
+  }
+  if (flags & TFS_FLAG_LEASE) {
+    if (size + sizeof(uint32_t) > available)
+      return TECNICOFS_ERROR_OTHER;
+    memset(buffer + size, 0, sizeof(uint32_t));
+    size += sizeof(uint32_t);
+  }
+  header.size = size - sizeof(tfs_header);
+  memcpy(buffer, &header, sizeof(tfs_header));
+  return size;
+}
 
-  /* receive server response */
-  if (recvfrom(client_sockfd, &result, sizeof(result), 0, 0, 0) < 0) {
-    perror("client: recvfrom error");
-    exit(EXIT_FAILURE);
-  } 
+/**
+ * Encodes a command of the input file format (ex: "c /a f", "l /a", "m /a /b").
+ * @param buffer: where the request is written
+ * @param available: size of the buffer
+ * @param command: command
+ * @return size of the request or TECNICOFS_ERROR_OTHER if it is invalid or
+ *         does not fit
+*/
+int encodeCommand(char *buffer, int available, char *command) {
+
+  int numTokens;
+  char token = '\0', arg1[MAX_INPUT_SIZE], arg2[MAX_INPUT_SIZE];
+
+  /* a command shorter than MAX_INPUT_SIZE has paths shorter than MAX_FILE_NAME */
+  numTokens = strlen(command) < MAX_INPUT_SIZE ? sscanf(command, "%c %s %s", &token, arg1, arg2) : 0;
+  if (token == 'c' && numTokens == 3 && (arg2[0] == 'f' || arg2[0] == 'd'))
+    return encodeRequest(buffer, available, TFS_OP_CREATE, arg2[0] == 'd' ? TFS_FLAG_DIRECTORY : 0, arg1, NULL);
+  if (token == 'l' && numTokens >= 2)
+    return encodeRequest(buffer, available, TFS_OP_LOOKUP, 0, arg1, NULL);
+  if (token == 'd' && numTokens >= 2)
+    return encodeRequest(buffer, available, TFS_OP_DELETE, TFS_FLAG_LEASE, arg1, NULL);
+  if (token == 'p' && numTokens >= 2)
+    return encodeRequest(buffer, available, TFS_OP_PRINT, 0, arg1, NULL);
+  if (token == 'm' && numTokens == 3)
+    return encodeRequest(buffer, available, TFS_OP_MOVE, TFS_FLAG_LEASE, arg1, arg2);
+  return TECNICOFS_ERROR_OTHER;
+}
+
+/**
+ * Receives the next reply, from the reply ring or from the socket. Only the
+ * thread taking replies calls it.
+ * @param session: session
+ * @param reply: where the reply is stored
+ * @param block: whether to wait for a reply
+ * @return 1 if a reply was received, 0 if there was none (without block) or
+ *         TECNICOFS_ERROR_CONNECTION_ERROR if the server is gone
+*/
+int receiveReply(tfs_session *session, tfs_batch_reply *reply, int block) {
+
+  shm_segment *shared = session->shared;
+
+  if (shared != NULL) {
+    struct timespec timeout = { 1, 0 };
+
+    if (!block && shm_load(&shared->replies.tail) == shared->replies.head.value)
+      return 0;
+    while (!shm_wait(&shared->replies, session->shared_spin, &timeout)) {
+      if (kill(shared->server_pid, 0) < 0 && errno == ESRCH) {
+        fprintf(stderr, "client: server terminated\n");
+        return TECNICOFS_ERROR_CONNECTION_ERROR;
+      }
+    }
+    uint32_t head = shared->replies.head.value;
+    tfs_batch_reply *slot = &shared->reply[head % SHM_RING_SLOTS];
+    /* only the reply to a batch is followed by results, a lease by its duration, a readdir and a stat by more */
+    reply->reply = slot->reply;
+    if (slot->reply.opcode == TFS_OP_BATCH && slot->reply.result > 0 && slot->reply.result <= MAX_TRANSACTION_OPS)
+      memcpy(reply->results, slot->results, slot->reply.result * sizeof(int32_t));
+    else if (slot->reply.flags & TFS_FLAG_LEASE)
+      memcpy(reply->results, slot->results, sizeof(uint32_t));
+    else if (slot->reply.opcode == TFS_OP_READDIR || slot->reply.opcode == TFS_OP_STAT)
+      memcpy(reply->results, slot->results, sizeof(slot->results));
+    shm_store(&shared->replies.head, head + 1);
+    return 1;
+  }
+
+  int c = recvfrom(session->sockfd, reply, sizeof(tfs_batch_reply), block ? 0 : MSG_DONTWAIT, 0, 0);
+  if (c <= 0) {
+    if (c < 0 && !block && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return 0;
+    if (c == 0)
+      fprintf(stderr, "client: connection closed by the server\n");
+    else
+      perror("client: recvfrom error");
+    return TECNICOFS_ERROR_CONNECTION_ERROR;
+  }
+  return 1;
+}
+
+/**
+ * Signals the descriptor of tfsAsyncFd, if it was asked for.
+ * @param session: session
+*/
+void signalCompletion(tfs_session *session) {
+
+  uint64_t one = 1;
+
+  if (session->async_eventfd >= 0 && write(session->async_eventfd, &one, sizeof(one)) < 0)
+    perror("client: eventfd error");
+}
+
+/**
+ * Keeps a reply in the entry of its request until the request is waited for.
+ * The results of a batch are copied to the array of tfsBatchSubmit, and the
+ * entries of a readdir and the attributes of a stat to the buffer of their call.
+ * Called with the lock of the session held.
+ * @param session: session
+ * @param message: reply received
+*/
+void stashReply(tfs_session *session, tfs_batch_reply *message) {
+
+  tfs_reply *reply = &message->reply;
+  reply_entry *entry = &session->stash[reply->request_id % MAX_PENDING];
+
+  if (reply->magic != TFS_MAGIC || !entry->used || entry->request_id != reply->request_id || entry->ready)
+    return;
+  if (entry->results != NULL && reply->opcode == TFS_OP_BATCH &&
+      reply->result > 0 && reply->result <= MAX_TRANSACTION_OPS)
+    memcpy(entry->results, message->results, reply->result * sizeof(int32_t));
+  if (entry->payload != NULL && (reply->opcode == TFS_OP_READDIR || reply->opcode == TFS_OP_STAT) &&
+      reply->result >= 0)
+    memcpy(entry->payload, message->results, sizeof(message->results));
+  entry->result = reply->result;
+  entry->ready = 1;
+  /* the duration of a lease is where the results of a batch would be */
+  entry->lease = 0;
+  if (reply->flags & TFS_FLAG_LEASE)
+    memcpy(&entry->lease, message->results, sizeof(uint32_t));
+  if (entry->mutation) {
+    entry->mutation = 0;
+    session->mutating--;
+  }
+
+  if (entry->async) {
+    session->async_ready++;
+    if (entry->callback != NULL)
+      session->completed[(session->completed_head + session->completed_count++) % MAX_PENDING] = reply->request_id;
+    signalCompletion(session);
+  }
+}
+
+/**
+ * Takes every reply already received, without waiting, unless another thread
+ * is taking replies. Called with the lock of the session held.
+ * @param session: session
+ * @return 0 or TECNICOFS_ERROR_CONNECTION_ERROR
+*/
+int receiveAvailable(tfs_session *session) {
+
+  int c;
+  tfs_batch_reply reply;
+
+  if (session->receiving)
+    return 0;
+  session->receiving = 1;
+  while (1) {
+    pthread_mutex_unlock(&session->lock);
+    c = receiveReply(session, &reply, 0);
+    pthread_mutex_lock(&session->lock);
+    if (c != 1)
+      break;
+    stashReply(session, &reply);
+  }
+  session->receiving = 0;
+  pthread_cond_broadcast(&session->replied);
+  return c;
+}
+
+/**
+ * Returns the current time of the monotonic clock, shared with the server.
+*/
+long monotonicNow() {
+
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+/**
+ * Returns the entry of the lookup cache where a path is kept (djb2).
+ * @param session: session
+ * @param path: path
+*/
+cache_entry *cacheSlot(tfs_session *session, char *path) {
+
+  unsigned hash = 5381;
+
+  while (*path != '\0')
+    hash = hash * 33 + (unsigned char) *path++;
+  return &session->cache[hash % LOOKUP_CACHE_SLOTS];
+}
+
+/**
+ * Answers a lookup from the cache, if the server still leases it.
+ * @param session: session
+ * @param path: path
+ * @param inumber: where the result is stored
+ * @return 1 if the lookup was answered
+*/
+int cachedLookup(tfs_session *session, char *path, int *inumber) {
+
+  cache_entry *entry = cacheSlot(session, path);
+  long now = monotonicNow();
+  int hit;
+
+  pthread_mutex_lock(&session->lock);
+  if ((hit = !strcmp(entry->path, path) && entry->expiry > now))
+    *inumber = entry->inumber;
+  pthread_mutex_unlock(&session->lock);
+  return hit;
+}
+
+/**
+ * Keeps a leased lookup in the cache, unless a delete or move of this session
+ * was sent since the lookup: as the server does not make those wait for the
+ * leases of their own session, the result may already be stale.
+ * @param session: session
+ * @param path: path
+ * @param inumber: result of the lookup
+ * @param expiry: when the lease expires
+ * @param mutations: deletes and moves sent by the session before the lookup
+*/
+void cacheLookup(tfs_session *session, char *path, int inumber, long expiry, unsigned mutations) {
+
+  cache_entry *entry = cacheSlot(session, path);
+
+  pthread_mutex_lock(&session->lock);
+  if (session->mutations == mutations) {
+    strcpy(entry->path, path);
+    entry->inumber = inumber;
+    entry->expiry = expiry;
+  }
+  pthread_mutex_unlock(&session->lock);
+}
+
+/**
+ * Drops the cached lookups of a path and of the paths under it.
+ * Called with the lock of the session held.
+ * @param session: session
+ * @param path: path deleted or moved
+*/
+void dropCached(tfs_session *session, char *path) {
+
+  int len = strlen(path);
+
+  for (int i = 0; i < LOOKUP_CACHE_SLOTS; i++) {
+    char *cached = session->cache[i].path;
+    if (!strncmp(cached, path, len) && (cached[len] == '\0' || cached[len] == '/'))
+      cached[0] = '\0';
+  }
+}
+
+/**
+ * Sets the lease owner of an operation that carries it and, if it is a
+ * delete or move, drops the cached lookups it changes.
+ * Called with the lock of the session held.
+ * @param session: session
+ * @param op: operation, a complete request
+ * @return 1 if the operation is a delete or move
+*/
+int prepareOperation(tfs_session *session, char *op) {
+
+  tfs_header header;
+
+  memcpy(&header, op, sizeof(tfs_header));
+  if (header.flags & TFS_FLAG_LEASE)
+    memcpy(op + sizeof(tfs_header) + header.size - sizeof(uint32_t), &session->owner, sizeof(uint32_t));
+  if (header.opcode != TFS_OP_DELETE && header.opcode != TFS_OP_MOVE)
+    return 0;
+  dropCached(session, op + sizeof(tfs_header));
+  return 1;
+}
+
+/**
+ * Prepares a request, or each operation of a transaction or batch, before
+ * it is sent (prepareOperation). Called with the lock of the session held.
+ * @param session: session
+ * @param buffer: request
+ * @param size: size of the request
+ * @return 1 if the request deletes or moves a path
+*/
+int prepareRequest(tfs_session *session, char *buffer, int size) {
+
+  tfs_header header, op;
+  int offset = sizeof(tfs_header), mutation = 0;
+
+  memcpy(&header, buffer, sizeof(tfs_header));
+  if (header.opcode != TFS_OP_TRANSACTION && header.opcode != TFS_OP_BATCH)
+    return prepareOperation(session, buffer);
+
+  for (int i = 0; i < header.length[0] && offset < size; i++) {
+    memcpy(&op, buffer + offset, sizeof(tfs_header));
+    mutation |= prepareOperation(session, buffer + offset);
+    offset += sizeof(tfs_header) + op.size;
+  }
+  return mutation;
+}
 
+/**
+ * Sends a request without waiting for its reply, after reserving its entry
+ * in the stash and setting its id.
+ * @param session: session
+ * @param buffer: request
+ * @param size: size of the request
+ * @param request: fields of the entry (asynchronous call and batch), or NULL
+ * @param id: where the id of the request is stored
+ * @return 0 or TECNICOFS_ERROR_CONNECTION_ERROR
+*/
+int postRequest(tfs_session *session, char *buffer, int size, reply_entry *request, uint32_t *id) {
+
+  int result = 0;
+  tfs_header header;
+  shm_segment *shared = session->shared;
+
+  pthread_mutex_lock(&session->lock);
+  memcpy(&header, buffer, sizeof(tfs_header));
+  header.request_id = *id = reserveEntry(session, request);
+  memcpy(buffer, &header, sizeof(tfs_header));
+  if (prepareRequest(session, buffer, size)) {
+    session->stash[*id % MAX_PENDING].mutation = 1;
+    session->mutations++;
+    session->mutating++;
+  }
+
+  if (shared != NULL) {
+    /* while the request ring is full the replies already sent are taken */
+    while (shared->requests.tail.value - shm_load(&shared->requests.head) >= SHM_RING_SLOTS) {
+      if ((result = receiveAvailable(session)) < 0)
+        break;
+      pthread_mutex_unlock(&session->lock);
+      sched_yield();
+      pthread_mutex_lock(&session->lock);
+    }
+    if (result == 0) {
+      shm_slot *slot = &shared->request[shared->requests.tail.value % SHM_RING_SLOTS];
+      memcpy(slot->data, buffer, size);
+      slot->size = size;
+      shm_publish(&shared->requests);
+    }
+  }
+  else {
+    pthread_mutex_unlock(&session->lock);
+    /* sends command to serv_addr, a connection already knows it */
+    while ((session->connected ? send(session->sockfd, buffer, size, MSG_DONTWAIT) :
+        sendto(session->sockfd, buffer, size, MSG_DONTWAIT, (struct sockaddr *) &session->serv_addr, session->servlen)) < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        perror("client: sendto error");
+        result = TECNICOFS_ERROR_CONNECTION_ERROR;
+        break;
+      }
+      /* the server may be blocked sending replies to this client, they are taken meanwhile */
+      struct pollfd pfd = { session->sockfd, POLLIN, 0 };
+      if (poll(&pfd, 1, 1) > 0) {
+        pthread_mutex_lock(&session->lock);
+        result = receiveAvailable(session);
+        pthread_mutex_unlock(&session->lock);
+        if (result < 0)
+          break;
+      }
+    }
+    pthread_mutex_lock(&session->lock);
+  }
+
+  if (result < 0)
+    freeEntry(session, &session->stash[*id % MAX_PENDING]);
+  pthread_mutex_unlock(&session->lock);
   return result;
 }
 
-int tfsDelete(char *path) {
+/**
+ * Waits until the reply of a request is in its entry. A single thread at a
+ * time takes replies, stashing those of other requests, and the others wait
+ * for it to stash theirs. Called with the lock of the session held.
+ * @param session: session
+ * @param entry: entry of the request in the stash
+ * @param id: id of the request
+ * @return 0 or TECNICOFS_ERROR_CONNECTION_ERROR
+*/
+int awaitReply(tfs_session *session, reply_entry *entry, uint32_t id) {
 
-  int servlen,result;
-  char buffer[MAX_INPUT_SIZE];
-  struct sockaddr_un serv_addr;
+  int c;
+  tfs_batch_reply reply;
 
-  sprintf(buffer,"d %s",path);
-  servlen = setSockAddrUn(serverName, &serv_addr);
+  while (!(entry->ready && entry->request_id == id)) {
+    if (session->receiving) {
+      pthread_cond_wait(&session->replied, &session->lock);
+      continue;
+    }
+    session->receiving = 1;
+    pthread_mutex_unlock(&session->lock);
+    c = receiveReply(session, &reply, 1);
+    pthread_mutex_lock(&session->lock);
+    session->receiving = 0;
+    if (c == 1)
+      stashReply(session, &reply);
+    pthread_cond_broadcast(&session->replied);
+    if (c < 0)
+      return TECNICOFS_ERROR_CONNECTION_ERROR;
+  }
+  return 0;
+}
+
+/**
+ * Waits for the reply of a request, terminating the client if the server is
+ * gone.
+ * @param session: session
+ * @param id: id of the request
+ * @param lease: where the duration of the lease of a lookup is stored, or NULL
+ * @return result of the operation
+*/
+int waitReply(tfs_session *session, uint32_t id, uint32_t *lease) {
 
-  /* sends command to serv_addr */
-  if (sendto(client_sockfd, buffer, strlen(buffer)+1, 0, (struct sockaddr *) &serv_addr, servlen) < 0) {
-    perror("client: sendto error");
+  reply_entry *entry = &session->stash[id % MAX_PENDING];
+  int c, result;
+
+  pthread_mutex_lock(&session->lock);
+  c = awaitReply(session, entry, id);
+  result = entry->result;
+  if (lease != NULL)
+    *lease = entry->lease;
+  freeEntry(session, entry);
+  pthread_mutex_unlock(&session->lock);
+
+  if (c < 0)
     exit(EXIT_FAILURE);
-  } 
+  return result;
+}
+
+/**
+ * Sends a request and waits for the reply with the same id.
+ * @param session: session
+ * @param buffer: request
+ * @param size: size of the request
+ * @param request: fields of the entry (batch), or NULL
+ * @return result of the operation
+*/
+int sendRequest(tfs_session *session, char *buffer, int size, reply_entry *request) {
+
+  uint32_t id;
 
-  /* receive server response */
-  if (recvfrom(client_sockfd, &result, sizeof(result), 0, 0, 0) < 0) {
-    perror("client: recvfrom error");
+  if (postRequest(session, buffer, size, request, &id) < 0)
     exit(EXIT_FAILURE);
-  } 
+  return waitReply(session, id, NULL);
+}
 
-  return result;
+/**
+ * Writes the header of a batch in front of its operations.
+ * @param batch: batch with at least one operation
+*/
+void sealBatch(tfs_batch *batch) {
+
+  tfs_header header;
+
+  header.magic = TFS_MAGIC;
+  header.version = TFS_VERSION;
+  header.opcode = TFS_OP_BATCH;
+  header.flags = 0;
+  header.request_id = 0;
+  header.size = batch->size - sizeof(tfs_header);
+  header.length[0] = batch->numOps;
+  header.length[1] = 0;
+  memcpy(batch->buffer, &header, sizeof(tfs_header));
 }
 
-int tfsMove(char *from, char *to) {
-  
-  int servlen,result;
-  char buffer[MAX_INPUT_SIZE];
-  struct sockaddr_un serv_addr;
+/**
+ * Waits for the reply to the batch of buffered operations that was sent, if
+ * any, and counts the operations that failed.
+ * Called with the deferred lock of the session held.
+ * @param session: session
+*/
+void awaitDeferred(tfs_session *session) {
+
+  deferred_batch *flushed = session->flushed;
+
+  if (flushed->id == 0)
+    return;
+  if (waitReply(session, flushed->id, NULL) < 0)
+    session->deferred_failed += flushed->batch.numOps;
+  else
+    for (int i = 0; i < flushed->batch.numOps; i++)
+      if (flushed->results[i] < 0)
+        session->deferred_failed++;
+  flushed->id = 0;
+  tfsBatchBegin(&flushed->batch);
+}
+
+/**
+ * Sends the buffered operations as a batch, without waiting for its reply.
+ * The batch sent before is waited for first, so the server executes the
+ * operations in the order they were made.
+ * Called with the deferred lock of the session held.
+ * @param session: session
+*/
+void flushDeferred(tfs_session *session) {
 
-  sprintf(buffer, "m %s %s",from,to);
-  servlen = setSockAddrUn(serverName, &serv_addr);  
+  deferred_batch *filling = session->filling;
+  reply_entry request = { 0 };
 
-  /* sends command to serv_addr */
-  if (sendto(client_sockfd, buffer, strlen(buffer)+1, 0, (struct sockaddr *) &serv_addr, servlen) < 0){
-    perror("client: sendto error");
+  if (filling->batch.numOps == 0)
+    return;
+  awaitDeferred(session);
+
+  sealBatch(&filling->batch);
+  request.results = filling->results;
+  if (postRequest(session, filling->batch.buffer, filling->batch.size, &request, &filling->id) < 0)
     exit(EXIT_FAILURE);
+  session->filling = session->flushed;
+  session->flushed = filling;
+}
+
+/**
+ * Checks whether a buffered or flushed operation changes a path: it is on
+ * the path itself or on a directory above it.
+ * @param batch: buffered or flushed operations
+ * @param path: path
+*/
+int deferredConflict(deferred_batch *batch, char *path) {
+
+  for (int i = 0; i < batch->batch.numOps; i++) {
+    int len = strlen(batch->paths[i]);
+
+    if (!strncmp(batch->paths[i], path, len) && (path[len] == '\0' || path[len] == '/'))
+      return 1;
   }
+  return 0;
+}
 
-  /* receive server response */
-  if (recvfrom(client_sockfd, &result, sizeof(result),0,0,0) < 0){
-    perror("client: recvfrom error");
-    exit(EXIT_FAILURE);
+/**
+ * Makes the operations buffered in write-behind mode visible before a call
+ * that may depend on them: they are sent and their reply is waited for. A
+ * lookup only waits for them if one of them changes its path.
+ * @param session: session
+ * @param path: path looked up, or NULL for any other call
+*/
+void settleDeferred(tfs_session *session, char *path) {
+
+  if (__atomic_load_n(&session->deferred_max, __ATOMIC_ACQUIRE) == 0)
+    return;
+  pthread_mutex_lock(&session->deferred_lock);
+  if (session->deferred_max > 0 && (path == NULL ||
+      deferredConflict(session->filling, path) || deferredConflict(session->flushed, path))) {
+    flushDeferred(session);
+    awaitDeferred(session);
   }
+  pthread_mutex_unlock(&session->deferred_lock);
+}
 
-  return result;
+/**
+ * Buffers a create or delete in write-behind mode, sending the buffer once
+ * it holds the operations of a batch.
+ * @param session: session
+ * @param opcode: TFS_OP_CREATE or TFS_OP_DELETE
+ * @param flags: flags of the operation
+ * @param path: path
+ * @return 1 if the operation was buffered, 0 if write-behind is disabled, or
+ *         TECNICOFS_ERROR_OTHER if the path is invalid
+*/
+int deferOperation(tfs_session *session, uint8_t opcode, uint8_t flags, char *path) {
+
+  deferred_batch *filling;
+  int size;
+
+  if (__atomic_load_n(&session->deferred_max, __ATOMIC_ACQUIRE) == 0)
+    return 0;
+  pthread_mutex_lock(&session->deferred_lock);
+  if (session->deferred_max == 0) {
+    pthread_mutex_unlock(&session->deferred_lock);
+    return 0;
+  }
+
+  filling = session->filling;
+  if (sizeof(filling->batch.buffer) - filling->batch.size < MAX_REQUEST_SIZE)
+    flushDeferred(session);
+  filling = session->filling;
+  size = encodeRequest(filling->batch.buffer + filling->batch.size,
+      sizeof(filling->batch.buffer) - filling->batch.size, opcode, flags, path, NULL);
+  if (size >= 0) {
+    strcpy(filling->paths[filling->batch.numOps++], path);
+    filling->batch.size += size;
+    if (filling->batch.numOps >= session->deferred_max)
+      flushDeferred(session);
+  }
+  pthread_mutex_unlock(&session->deferred_lock);
+  return size < 0 ? size : 1;
 }
 
-int tfsLookup(char *path) {
+/**
+ * Enables or disables the write-behind mode of a session. In write-behind
+ * mode creates and deletes return 0 right away and are buffered, and sent in
+ * batches of batchSize operations. The server executes them in order. The
+ * calls that may depend on them send them and wait for them first: a lookup
+ * of a path they change, and any other call. Their failures are counted
+ * until tfsSync.
+ * @param session: session
+ * @param batchSize: operations per batch, up to MAX_TRANSACTION_OPS, or 0 to
+ *                   send the buffered operations and disable the mode
+ * @return 0 or TECNICOFS_ERROR_OTHER
+*/
+int tfsSessionWriteBehind(tfs_session *session, int batchSize) {
 
-  int servlen,result;
-  char buffer[MAX_INPUT_SIZE];
-  struct sockaddr_un serv_addr;
+  if (batchSize < 0 || batchSize > MAX_TRANSACTION_OPS)
+    return TECNICOFS_ERROR_OTHER;
 
-  sprintf(buffer, "l %s", path);
-  servlen = setSockAddrUn(serverName, &serv_addr);  
+  pthread_mutex_lock(&session->deferred_lock);
+  if (batchSize > 0 && session->filling == NULL) {
+    session->filling = (deferred_batch*) calloc(1, sizeof(deferred_batch));
+    session->flushed = (deferred_batch*) calloc(1, sizeof(deferred_batch));
+    if (session->filling == NULL || session->flushed == NULL) {
+      free(session->filling);
+      free(session->flushed);
+      session->filling = session->flushed = NULL;
+      pthread_mutex_unlock(&session->deferred_lock);
+      return TECNICOFS_ERROR_OTHER;
+    }
+    tfsBatchBegin(&session->filling->batch);
+    tfsBatchBegin(&session->flushed->batch);
+  }
+  else if (batchSize == 0 && session->filling != NULL) {
+    flushDeferred(session);
+    awaitDeferred(session);
+  }
+  __atomic_store_n(&session->deferred_max, batchSize, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&session->deferred_lock);
+  return 0;
+}
 
-  /* sends command to serv_addr */
-  if (sendto(client_sockfd, buffer, strlen(buffer)+1, 0, (struct sockaddr *) &serv_addr, servlen) < 0){
-    perror("client: sendto error");
-    exit(EXIT_FAILURE);
+/**
+ * Sends the operations buffered in write-behind mode, without waiting for
+ * their reply.
+ * @param session: session
+ * @return 0
+*/
+int tfsSessionFlush(tfs_session *session) {
+
+  pthread_mutex_lock(&session->deferred_lock);
+  if (session->filling != NULL)
+    flushDeferred(session);
+  pthread_mutex_unlock(&session->deferred_lock);
+  return 0;
+}
+
+/**
+ * Sends the operations buffered in write-behind mode and waits for them.
+ * @param session: session
+ * @return number of buffered operations that failed since the last call
+*/
+int tfsSessionSync(tfs_session *session) {
+
+  int failed;
+
+  pthread_mutex_lock(&session->deferred_lock);
+  if (session->filling != NULL) {
+    flushDeferred(session);
+    awaitDeferred(session);
   }
+  failed = session->deferred_failed;
+  session->deferred_failed = 0;
+  pthread_mutex_unlock(&session->deferred_lock);
+  return failed;
+}
+
+/**
+ * Encodes a request with up to two paths and sends it.
+ * @return result of the operation
+*/
+int requestOperation(tfs_session *session, uint8_t opcode, uint8_t flags, char *path, char *dest) {
+
+  char buffer[MAX_REQUEST_SIZE];
+  int size = encodeRequest(buffer, sizeof(buffer), opcode, flags, path, dest);
+
+  if (size < 0)
+    return size;
+  return sendRequest(session, buffer, size, NULL);
+}
+
+int tfsSessionCreate(tfs_session *session, char *filename, char nodeType) {
+
+  uint8_t flags = nodeType == 'd' ? TFS_FLAG_DIRECTORY : 0;
+  int deferred = deferOperation(session, TFS_OP_CREATE, flags, filename);
+
+  if (deferred != 0)
+    return deferred < 0 ? deferred : 0;
+  return requestOperation(session, TFS_OP_CREATE, flags, filename, NULL);
+}
 
-  /* receive server response */
-  if (recvfrom(client_sockfd, &result, sizeof(result),0,0,0) < 0){
-    perror("client: recvfrom error");
+int tfsSessionDelete(tfs_session *session, char *path) {
+
+  int deferred = deferOperation(session, TFS_OP_DELETE, TFS_FLAG_LEASE, path);
+
+  if (deferred != 0)
+    return deferred < 0 ? deferred : 0;
+  return requestOperation(session, TFS_OP_DELETE, TFS_FLAG_LEASE, path, NULL);
+}
+
+int tfsSessionMove(tfs_session *session, char *from, char *to) {
+  settleDeferred(session, NULL);
+  return requestOperation(session, TFS_OP_MOVE, TFS_FLAG_LEASE, from, to);
+}
+
+/**
+ * Looks up a path, answering from the cache while the server leases the
+ * result of an earlier lookup. The lookups that reach the server ask for a
+ * lease.
+ * @param session: session
+ * @param path: path
+ * @return inumber of the path, or an error
+*/
+int tfsSessionLookup(tfs_session *session, char *path) {
+
+  char buffer[MAX_REQUEST_SIZE];
+  uint32_t id, lease;
+  unsigned mutations;
+  int size, result, cacheable;
+  long sent;
+
+  settleDeferred(session, path);
+  if (cachedLookup(session, path, &result))
+    return result;
+  if ((size = encodeRequest(buffer, sizeof(buffer), TFS_OP_LOOKUP, TFS_FLAG_LEASE, path, NULL)) < 0)
+    return size;
+
+  /* the lease is counted from before the server grants it */
+  sent = monotonicNow();
+  pthread_mutex_lock(&session->lock);
+  mutations = session->mutations;
+  cacheable = session->mutating == 0;
+  pthread_mutex_unlock(&session->lock);
+
+  if (postRequest(session, buffer, size, NULL, &id) < 0)
     exit(EXIT_FAILURE);
+  result = waitReply(session, id, &lease);
+
+  /* a delete or move of this session in flight may not have waited for the lease */
+  if (lease > 0 && result >= 0 && cacheable)
+    cacheLookup(session, path, result, sent + lease * 1000L, mutations);
+  return result;
+}
+
+/**
+ * Lists a page of the entries of a directory. The server holds only read
+ * locks while it lists a page, so listing a big directory page by page does
+ * not stop the changes to it for long.
+ * @param session: session
+ * @param path: path of the directory
+ * @param cursor: 0 to start the listing, then the value left by the previous
+ *                call; set to 0 once the listing is complete
+ * @param entries: where the entries are stored
+ * @param max: entries listed at most, up to TFS_READDIR_MAX_ENTRIES per call
+ * @return number of entries listed, or an error
+*/
+int tfsSessionReaddir(tfs_session *session, char *path, int *cursor, tfs_dirent_info entries[], int max) {
+
+  char buffer[MAX_REQUEST_SIZE], listing[TFS_MAX_REPLY_SIZE - sizeof(tfs_reply)];
+  tfs_readdir_args args = { *cursor, max };
+  tfs_header header;
+  reply_entry request = { 0 };
+  int size, result, offset = sizeof(uint32_t);
+
+  if (*cursor < 0 || max <= 0)
+    return TECNICOFS_ERROR_OTHER;
+  settleDeferred(session, NULL);
+  if ((size = encodeRequest(buffer, sizeof(buffer) - sizeof(args), TFS_OP_READDIR, 0, path, NULL)) < 0)
+    return size;
+
+  /* the cursor and the count follow the path */
+  memcpy(buffer + size, &args, sizeof(args));
+  size += sizeof(args);
+  memcpy(&header, buffer, sizeof(tfs_header));
+  header.size += sizeof(args);
+  memcpy(buffer, &header, sizeof(tfs_header));
+
+  request.payload = listing;
+  if ((result = sendRequest(session, buffer, size, &request)) < 0)
+    return result;
+
+  memcpy(cursor, listing, sizeof(uint32_t));
+  for (int i = 0; i < result && i < max; i++) {
+    tfs_dirent dirent;
+
+    memcpy(&dirent, listing + offset, sizeof(dirent));
+    offset += sizeof(dirent);
+    memcpy(entries[i].name, listing + offset, dirent.length + 1);
+    offset += dirent.length + 1;
+    entries[i].inumber = dirent.inumber;
+    entries[i].nodeType = dirent.type;
   }
+  return result;
+}
 
+/**
+ * Looks up a path and reads the attributes of its node in one request.
+ * @param session: session
+ * @param path: path
+ * @param st: where the attributes are stored
+ * @return inumber of the path, or an error
+*/
+int tfsSessionStat(tfs_session *session, char *path, tfs_stat *st) {
+
+  char buffer[MAX_REQUEST_SIZE], attributes[TFS_MAX_REPLY_SIZE - sizeof(tfs_reply)];
+  tfs_stat_reply reply;
+  reply_entry request = { 0 };
+  int size, result;
+
+  if ((size = encodeRequest(buffer, sizeof(buffer), TFS_OP_STAT, 0, path, NULL)) < 0)
+    return size;
+  settleDeferred(session, NULL);
+
+  request.payload = attributes;
+  if ((result = sendRequest(session, buffer, size, &request)) < 0)
+    return result;
+
+  memcpy((char *) &reply + sizeof(tfs_reply), attributes, sizeof(reply) - sizeof(tfs_reply));
+  st->inumber = result;
+  st->nodeType = reply.type;
+  st->size = reply.size;
+  st->generation = reply.generation;
   return result;
 }
 
-int tfsPrint(char *file){
+int tfsSessionPrint(tfs_session *session, char *file) {
+  settleDeferred(session, NULL);
+  return requestOperation(session, TFS_OP_PRINT, 0, file, NULL);
+}
 
-  int servlen,result;
-  char buffer[MAX_INPUT_SIZE];
-  struct sockaddr_un serv_addr;
+/**
+ * Applies a list of create/delete/move commands atomically on the server.
+ * Each command uses the same format as the input file (ex: "c /a f", "m /a /b").
+ * @param session: session
+ * @param commands: array of commands
+ * @param numCommands: number of commands
+ * @return 0 if every command was applied, otherwise none was applied
+*/
+int tfsSessionTransaction(tfs_session *session, char *commands[], int numCommands) {
 
-  sprintf(buffer, "p %s", file);
-  servlen = setSockAddrUn(serverName, &serv_addr);  
+  int size, numTokens;
+  char token, arg1[MAX_INPUT_SIZE], arg2[MAX_INPUT_SIZE];
+  char buffer[MAX_MESSAGE_SIZE];
+  tfs_header header;
 
-  /* sends command to serv_addr */
-  if (sendto(client_sockfd, buffer, strlen(buffer)+1, 0, (struct sockaddr *) &serv_addr, servlen) < 0){
-    perror("client: sendto error");
-    exit(EXIT_FAILURE);
+  if (numCommands <= 0 || numCommands > MAX_TRANSACTION_OPS)
+    return TECNICOFS_ERROR_OTHER;
+  settleDeferred(session, NULL);
+
+  /* every operation is a complete request after the header of the transaction */
+  size = sizeof(tfs_header);
+  for (int i = 0; i < numCommands; i++) {
+    int opSize;
+
+    if (strlen(commands[i]) >= MAX_INPUT_SIZE)
+      return TECNICOFS_ERROR_OTHER;
+    token = '\0';
+    numTokens = sscanf(commands[i], "%c %s %s", &token, arg1, arg2);
+    if (token == 'c' && numTokens == 3 && (arg2[0] == 'f' || arg2[0] == 'd'))
+      opSize = encodeRequest(buffer + size, sizeof(buffer) - size, TFS_OP_CREATE,
+        arg2[0] == 'd' ? TFS_FLAG_DIRECTORY : 0, arg1, NULL);
+    else if (token == 'd' && numTokens == 2)
+      opSize = encodeRequest(buffer + size, sizeof(buffer) - size, TFS_OP_DELETE, TFS_FLAG_LEASE, arg1, NULL);
+    else if (token == 'm' && numTokens == 3)
+      opSize = encodeRequest(buffer + size, sizeof(buffer) - size, TFS_OP_MOVE, TFS_FLAG_LEASE, arg1, arg2);
+    else
+      return TECNICOFS_ERROR_OTHER;
+    if (opSize < 0)
+      return opSize;
+    size += opSize;
   }
 
-  /* receive server response */
-  if (recvfrom(client_sockfd, &result, sizeof(result),0,0,0) < 0){
-    perror("client: recvfrom error");
-    exit(EXIT_FAILURE);
+  header.magic = TFS_MAGIC;
+  header.version = TFS_VERSION;
+  header.opcode = TFS_OP_TRANSACTION;
+  header.flags = 0;
+  header.request_id = 0;
+  header.size = size - sizeof(tfs_header);
+  header.length[0] = numCommands;
+  header.length[1] = 0;
+  memcpy(buffer, &header, sizeof(tfs_header));
+
+  /* sends every command in a single message to serv_addr */
+  return sendRequest(session, buffer, size, NULL);
+}
+
+/**
+ * Sends many commands without waiting for each reply, keeping up to
+ * MAX_IN_FLIGHT of them in flight. The server may complete them in any order.
+ * Each command uses the same format as the input file (ex: "c /a f", "l /a").
+ * @param session: session
+ * @param commands: array of commands
+ * @param numCommands: number of commands
+ * @param results: where the result of each command is stored
+ * @return 0, or TECNICOFS_ERROR_OTHER if a command is invalid (none is sent)
+*/
+int tfsSessionPipeline(tfs_session *session, char *commands[], int numCommands, int results[]) {
+
+  int size;
+  char buffer[MAX_REQUEST_SIZE];
+  uint32_t *ids = (uint32_t*) malloc(sizeof(uint32_t) * (numCommands > 0 ? numCommands : 1));
+  int done = 0;
+
+  if (ids == NULL)
+    return TECNICOFS_ERROR_OTHER;
+
+  /* every command is validated before the first one is sent */
+  for (int i = 0; i < numCommands; i++) {
+    if (encodeCommand(buffer, sizeof(buffer), commands[i]) < 0) {
+      free(ids);
+      return TECNICOFS_ERROR_OTHER;
+    }
+  }
+  settleDeferred(session, NULL);
+
+  for (int i = 0; i < numCommands; i++) {
+    size = encodeCommand(buffer, sizeof(buffer), commands[i]);
+
+    /* the oldest request is waited for once the window is full */
+    if (i - done == MAX_IN_FLIGHT) {
+      results[done] = waitReply(session, ids[done], NULL);
+      done++;
+    }
+    if (postRequest(session, buffer, size, NULL, &ids[i]) < 0)
+      exit(EXIT_FAILURE);
   }
 
+  for (; done < numCommands; done++)
+    results[done] = waitReply(session, ids[done], NULL);
+
+  free(ids);
+  return 0;
+}
+
+/**
+ * Starts an empty batch.
+ * @param batch: batch
+*/
+void tfsBatchBegin(tfs_batch *batch) {
+  batch->size = sizeof(tfs_header);
+  batch->numOps = 0;
+}
+
+/**
+ * Adds a create, delete, lookup or move command to a batch, in the same
+ * format as the input file (ex: "c /a f", "l /a").
+ * @param batch: batch
+ * @param command: command
+ * @return number of commands in the batch, 0 if the batch is full (the
+ *         command was not added) or TECNICOFS_ERROR_OTHER if it is invalid
+*/
+int tfsBatchAdd(tfs_batch *batch, char *command) {
+
+  int size;
+
+  if (command[0] != 'c' && command[0] != 'd' && command[0] != 'l' && command[0] != 'm')
+    return TECNICOFS_ERROR_OTHER;
+  if (batch->numOps == MAX_TRANSACTION_OPS ||
+      sizeof(batch->buffer) - batch->size < MAX_REQUEST_SIZE)
+    return 0;
+  if ((size = encodeCommand(batch->buffer + batch->size, sizeof(batch->buffer) - batch->size, command)) < 0)
+    return size;
+  batch->size += size;
+  return ++batch->numOps;
+}
+
+/**
+ * Sends every command of a batch in a single request and waits for it. The
+ * server executes them in order, each one on its own (a command that fails
+ * does not stop the following ones). The batch is left empty.
+ * @param session: session
+ * @param batch: batch
+ * @param results: where the result of each command is stored, in order
+ * @return 0 or TECNICOFS_ERROR_OTHER if the server refused the batch
+*/
+int tfsSessionBatchSubmit(tfs_session *session, tfs_batch *batch, int results[]) {
+
+  reply_entry request = { 0 };
+  int result;
+
+  if (batch->numOps == 0)
+    return 0;
+  settleDeferred(session, NULL);
+
+  sealBatch(batch);
+  request.results = results;
+  result = sendRequest(session, batch->buffer, batch->size, &request);
+
+  tfsBatchBegin(batch);
+  return result < 0 ? TECNICOFS_ERROR_OTHER : 0;
+}
+
+/**
+ * Encodes a request with up to two paths and sends it without waiting for
+ * its reply.
+ * @param session: session
+ * @param callback: called by tfsPoll with the result, or NULL to take it
+ *                  with tfsTest or tfsWait
+ * @param arg: argument of the callback
+ * @return ticket of the request (positive), or TECNICOFS_ERROR_BUSY if too
+ *         many asynchronous requests are waiting
+*/
+int requestAsync(tfs_session *session, uint8_t opcode, uint8_t flags, char *path, char *dest,
+    tfs_callback callback, void *arg) {
+
+  char buffer[MAX_REQUEST_SIZE];
+  reply_entry request = { 0 };
+  uint32_t id;
+  int size, busy;
+
+  if ((size = encodeRequest(buffer, sizeof(buffer), opcode, flags, path, dest)) < 0)
+    return size;
+  settleDeferred(session, NULL);
+
+  /* the synchronous calls keep room for a full window of requests */
+  pthread_mutex_lock(&session->lock);
+  if (!(busy = session->async_pending >= MAX_PENDING - MAX_IN_FLIGHT))
+    session->async_pending++;
+  pthread_mutex_unlock(&session->lock);
+  if (busy)
+    return TECNICOFS_ERROR_BUSY;
+
+  request.async = 1;
+  request.callback = callback;
+  request.arg = arg;
+  if (postRequest(session, buffer, size, &request, &id) < 0) {
+    pthread_mutex_lock(&session->lock);
+    session->async_pending--;
+    pthread_mutex_unlock(&session->lock);
+    return TECNICOFS_ERROR_CONNECTION_ERROR;
+  }
+  return (int) id;
+}
+
+/**
+ * Returns the entry of an asynchronous request that was not completed yet.
+ * Called with the lock of the session held.
+ * @param session: session
+ * @param ticket: ticket of the request
+ * @return entry, or NULL if the ticket is not valid
+*/
+reply_entry *ticketEntry(tfs_session *session, int ticket) {
+
+  reply_entry *entry = &session->stash[(uint32_t) ticket % MAX_PENDING];
+
+  if (ticket <= 0 || !entry->used || !entry->async || entry->request_id != (uint32_t) ticket)
+    return NULL;
+  return entry;
+}
+
+/**
+ * Completes an asynchronous request, whose ticket is no longer valid.
+ * Called with the lock of the session held.
+ * @param session: session
+ * @param entry: entry of the request
+*/
+void releaseEntry(tfs_session *session, reply_entry *entry) {
+  if (entry->ready)
+    session->async_ready--;
+  session->async_pending--;
+  freeEntry(session, entry);
+}
+
+int tfsSessionCreateAsync(tfs_session *session, char *filename, char nodeType, tfs_callback callback, void *arg) {
+  return requestAsync(session, TFS_OP_CREATE, nodeType == 'd' ? TFS_FLAG_DIRECTORY : 0, filename, NULL, callback, arg);
+}
+
+int tfsSessionDeleteAsync(tfs_session *session, char *path, tfs_callback callback, void *arg) {
+  return requestAsync(session, TFS_OP_DELETE, TFS_FLAG_LEASE, path, NULL, callback, arg);
+}
+
+int tfsSessionLookupAsync(tfs_session *session, char *path, tfs_callback callback, void *arg) {
+  return requestAsync(session, TFS_OP_LOOKUP, 0, path, NULL, callback, arg);
+}
+
+int tfsSessionMoveAsync(tfs_session *session, char *from, char *to, tfs_callback callback, void *arg) {
+  return requestAsync(session, TFS_OP_MOVE, TFS_FLAG_LEASE, from, to, callback, arg);
+}
+
+int tfsSessionPrintAsync(tfs_session *session, char *file, tfs_callback callback, void *arg) {
+  return requestAsync(session, TFS_OP_PRINT, 0, file, NULL, callback, arg);
+}
+
+/**
+ * Takes the replies already received, without waiting, and calls the
+ * callback of every asynchronous request that completed, in the order the
+ * replies arrived. A callback may issue new requests.
+ * @param session: session
+ * @return number of callbacks called, or TECNICOFS_ERROR_CONNECTION_ERROR
+*/
+int tfsSessionPoll(tfs_session *session) {
+
+  uint64_t count;
+  int called = 0;
+
+  pthread_mutex_lock(&session->lock);
+  /* the descriptor is cleared first, a reply arriving from now on signals it again */
+  if (session->async_eventfd >= 0 && read(session->async_eventfd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+    perror("client: eventfd error");
+  if (receiveAvailable(session) < 0) {
+    pthread_mutex_unlock(&session->lock);
+    return TECNICOFS_ERROR_CONNECTION_ERROR;
+  }
+
+  while (session->completed_count > 0) {
+    uint32_t id = session->completed[session->completed_head];
+    reply_entry *entry = ticketEntry(session, (int) id);
+
+    session->completed_head = (session->completed_head + 1) % MAX_PENDING;
+    session->completed_count--;
+    /* tfsWait may have taken the result already */
+    if (entry == NULL || !entry->ready)
+      continue;
+
+    tfs_callback callback = entry->callback;
+    void *arg = entry->arg;
+    int result = entry->result;
+    releaseEntry(session, entry);
+    pthread_mutex_unlock(&session->lock);
+    callback((int) id, result, arg);
+    pthread_mutex_lock(&session->lock);
+    called++;
+  }
+  pthread_mutex_unlock(&session->lock);
+  return called;
+}
+
+/**
+ * Checks, without waiting, whether an asynchronous request completed.
+ * @param session: session
+ * @param ticket: ticket of the request
+ * @param result: where the result is stored if it completed
+ * @return 1 if it completed (the ticket is no longer valid), 0 if not,
+ *         TECNICOFS_ERROR_OTHER for an invalid ticket or
+ *         TECNICOFS_ERROR_CONNECTION_ERROR
+*/
+int tfsSessionTest(tfs_session *session, int ticket, int *result) {
+
+  reply_entry *entry;
+  int c = 1;
+
+  pthread_mutex_lock(&session->lock);
+  if ((entry = ticketEntry(session, ticket)) == NULL)
+    c = TECNICOFS_ERROR_OTHER;
+  else if (!entry->ready && receiveAvailable(session) < 0)
+    c = TECNICOFS_ERROR_CONNECTION_ERROR;
+  else if (!entry->ready)
+    c = 0;
+  else {
+    *result = entry->result;
+    releaseEntry(session, entry);
+  }
+  pthread_mutex_unlock(&session->lock);
+  return c;
+}
+
+/**
+ * Waits for an asynchronous request to complete. Its callback is not called.
+ * @param session: session
+ * @param ticket: ticket of the request
+ * @return result of the operation, TECNICOFS_ERROR_OTHER for an invalid
+ *         ticket or TECNICOFS_ERROR_CONNECTION_ERROR
+*/
+int tfsSessionWait(tfs_session *session, int ticket) {
+
+  reply_entry *entry;
+  int result;
+
+  pthread_mutex_lock(&session->lock);
+  if ((entry = ticketEntry(session, ticket)) == NULL)
+    result = TECNICOFS_ERROR_OTHER;
+  else if (awaitReply(session, entry, (uint32_t) ticket) < 0)
+    result = TECNICOFS_ERROR_CONNECTION_ERROR;
+  else {
+    result = entry->result;
+    releaseEntry(session, entry);
+  }
+  pthread_mutex_unlock(&session->lock);
   return result;
 }
 
-int tfsMount(char * sockPath) {
+/**
+ * Returns a descriptor for an event loop, readable while replies are waiting
+ * to be taken by tfsPoll or tfsTest. It is only available over a socket,
+ * not with the shared memory transport.
+ * @param session: session
+ * @return descriptor, or TECNICOFS_ERROR_OTHER
+*/
+int tfsSessionAsyncFd(tfs_session *session) {
+
+  struct epoll_event event;
+  int fd;
+
+  if (session->shared != NULL)
+    return TECNICOFS_ERROR_OTHER;
+
+  pthread_mutex_lock(&session->lock);
+  if (session->async_epfd < 0) {
+    /* replies taken while sending are only in the stash, the eventfd reports them */
+    if ((session->async_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0 ||
+        (session->async_epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+      perror("client: async descriptor error");
+      if (session->async_eventfd >= 0)
+        close(session->async_eventfd);
+      session->async_eventfd = -1;
+      pthread_mutex_unlock(&session->lock);
+      return TECNICOFS_ERROR_OTHER;
+    }
+    event.events = EPOLLIN;
+    event.data.fd = session->sockfd;
+    epoll_ctl(session->async_epfd, EPOLL_CTL_ADD, session->sockfd, &event);
+    event.data.fd = session->async_eventfd;
+    epoll_ctl(session->async_epfd, EPOLL_CTL_ADD, session->async_eventfd, &event);
+
+    if (session->async_ready > 0)
+      signalCompletion(session);
+  }
+  fd = session->async_epfd;
+  pthread_mutex_unlock(&session->lock);
+  return fd;
+}
+
+/**
+ * Creates a segment with the request and reply rings and asks the server to
+ * serve it. The requests keep going through the socket if the server refuses.
+ * @param session: session
+ * @return 0 if the shared memory transport is used
+*/
+int mountShared(tfs_session *session) {
+
+  int fd, result;
+  char name[MAX_SOCKET_NAME];
+  shm_segment *segment;
+
+  sprintf(name, "/tecnicofs-%d-%d", getpid(), session->number);
+  shm_unlink(name);
+  if ((fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600)) < 0)
+    return TECNICOFS_ERROR_OTHER;
+  if (ftruncate(fd, sizeof(shm_segment)) < 0 ||
+      (segment = mmap(NULL, sizeof(shm_segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+    close(fd);
+    shm_unlink(name);
+    return TECNICOFS_ERROR_OTHER;
+  }
+  close(fd);
+
+  /* the segment starts zeroed, the rings are empty */
+  segment->magic = SHM_MAGIC;
+  segment->client_pid = getpid();
+  session->shared_spin = shm_spin();
+
+  result = requestOperation(session, TFS_OP_MOUNT, 0, name, NULL);
+  /* both processes have it mapped or the server gave up, the name is no longer needed */
+  shm_unlink(name);
+
+  if (result != 0) {
+    munmap(segment, sizeof(shm_segment));
+    return TECNICOFS_ERROR_CONNECTION_ERROR;
+  }
+  session->shared = segment;
+  return 0;
+}
+
+/**
+ * Connects to a server running in connection mode.
+ * @param session: session
+ * @return 0 if connected, -1 if the server only takes datagrams
+*/
+int connectServer(tfs_session *session) {
+
+  if ((session->sockfd = socket(AF_UNIX, SOCK_SEQPACKET, 0)) < 0) {
+    perror("client: can't open socket");
+    exit(EXIT_FAILURE);
+  }
+  if (connect(session->sockfd, (struct sockaddr *) &session->serv_addr, session->servlen) < 0) {
+    close(session->sockfd);
+    return -1;
+  }
+  session->connected = 1;
+  return 0;
+}
+
+/**
+ * Opens a session with a server. Any number of threads may use it at once.
+ * @param sockPath: name of the server socket
+ * @return session, or NULL if it could not be allocated
+*/
+tfs_session *tfsMountSession(char *sockPath) {
 
   socklen_t clilen;
   struct sockaddr_un client_addr;
-  client_socket_name = (char*) malloc(sizeof(char)*(MAX_SOCKET_NAME+1));
+  tfs_session *session = (tfs_session*) calloc(1, sizeof(tfs_session));
+
+  if (session == NULL)
+    return NULL;
+  session->number = __atomic_fetch_add(&sessions, 1, __ATOMIC_RELAXED);
+  session->async_eventfd = session->async_epfd = -1;
+  session->owner = (uint32_t) getpid() << 10 | (session->number % 1024);
+  pthread_mutex_init(&session->lock, NULL);
+  pthread_cond_init(&session->replied, NULL);
+  pthread_mutex_init(&session->deferred_lock, NULL);
+  session->servlen = setSockAddrUn(sockPath, &session->serv_addr);
+
+  /* a connection needs no name for the client socket */
+  if (connectServer(session) == 0) {
+    if (getenv("TECNICOFS_SHARED_MEMORY") != NULL)
+      mountShared(session);
+    return session;
+  }
 
   /* creates a socket of domain UNIX and type DATAGRAM */
-  if ((client_sockfd = socket(AF_UNIX, SOCK_DGRAM, 0) ) < 0) { 
+  if ((session->sockfd = socket(AF_UNIX, SOCK_DGRAM, 0) ) < 0) {
     perror("client: can't open socket");
     exit(EXIT_FAILURE);
   }
-  
-  createSocketName();
-  unlink(client_socket_name);
+
+  createSocketName(session);
+  unlink(session->socket_name);
 
   /* clears and set the socket address */
-  clilen = setSockAddrUn (client_socket_name, &client_addr);
+  clilen = setSockAddrUn(session->socket_name, &client_addr);
 
   /* binds a name to the socket, this name is specified by the server_addr */
-  if (bind(client_sockfd, (struct sockaddr *) &client_addr, clilen) < 0) {
+  if (bind(session->sockfd, (struct sockaddr *) &client_addr, clilen) < 0) {
     perror("client: bind error");
     exit(EXIT_FAILURE);
-  } 
+  }
+
+  /* the shared memory transport is opt-in */
+  if (getenv("TECNICOFS_SHARED_MEMORY") != NULL)
+    mountShared(session);
+  return session;
+}
+
+/**
+ * Closes a session, which no thread may be using.
+ * Asynchronous requests still waiting are dropped.
+ * @param session: session
+*/
+int tfsUnmountSession(tfs_session *session) {
+
+  /* the buffered operations are still applied */
+  tfsSessionWriteBehind(session, 0);
+  free(session->filling);
+  free(session->flushed);
+
+  if (session->shared != NULL) {
+    /* the server thread of the session wakes up and terminates */
+    __atomic_store_n(&session->shared->closed, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &session->shared->requests.tail.value, FUTEX_WAKE, 1, NULL, NULL, 0);
+    munmap(session->shared, sizeof(shm_segment));
+  }
+  if (session->async_epfd >= 0) {
+    close(session->async_epfd);
+    close(session->async_eventfd);
+  }
+
+  close(session->sockfd);
+  if (!session->connected)
+    unlink(session->socket_name);
+  pthread_mutex_destroy(&session->lock);
+  pthread_cond_destroy(&session->replied);
+  pthread_mutex_destroy(&session->deferred_lock);
+  free(session);
+  return EXIT_SUCCESS;
+}
+
+int tfsCreate(char *filename, char nodeType) {
+  return tfsSessionCreate(default_session, filename, nodeType);
+}
+
+int tfsDelete(char *path) {
+  return tfsSessionDelete(default_session, path);
+}
+
+int tfsMove(char *from, char *to) {
+  return tfsSessionMove(default_session, from, to);
+}
+
+int tfsLookup(char *path) {
+  return tfsSessionLookup(default_session, path);
+}
+
+int tfsReaddir(char *path, int *cursor, tfs_dirent_info entries[], int max) {
+  return tfsSessionReaddir(default_session, path, cursor, entries, max);
+}
+
+int tfsStat(char *path, tfs_stat *st) {
+  return tfsSessionStat(default_session, path, st);
+}
+
+int tfsWriteBehind(int batchSize) {
+  return tfsSessionWriteBehind(default_session, batchSize);
+}
+
+int tfsFlush() {
+  return tfsSessionFlush(default_session);
+}
+
+int tfsSync() {
+  return tfsSessionSync(default_session);
+}
+
+int tfsPrint(char *file) {
+  return tfsSessionPrint(default_session, file);
+}
+
+int tfsTransaction(char *commands[], int numCommands) {
+  return tfsSessionTransaction(default_session, commands, numCommands);
+}
+
+int tfsPipeline(char *commands[], int numCommands, int results[]) {
+  return tfsSessionPipeline(default_session, commands, numCommands, results);
+}
+
+int tfsBatchSubmit(tfs_batch *batch, int results[]) {
+  return tfsSessionBatchSubmit(default_session, batch, results);
+}
+
+int tfsCreateAsync(char *filename, char nodeType, tfs_callback callback, void *arg) {
+  return tfsSessionCreateAsync(default_session, filename, nodeType, callback, arg);
+}
+
+int tfsDeleteAsync(char *path, tfs_callback callback, void *arg) {
+  return tfsSessionDeleteAsync(default_session, path, callback, arg);
+}
+
+int tfsLookupAsync(char *path, tfs_callback callback, void *arg) {
+  return tfsSessionLookupAsync(default_session, path, callback, arg);
+}
+
+int tfsMoveAsync(char *from, char *to, tfs_callback callback, void *arg) {
+  return tfsSessionMoveAsync(default_session, from, to, callback, arg);
+}
+
+int tfsPrintAsync(char *file, tfs_callback callback, void *arg) {
+  return tfsSessionPrintAsync(default_session, file, callback, arg);
+}
+
+int tfsPoll() {
+  return tfsSessionPoll(default_session);
+}
+
+int tfsTest(int ticket, int *result) {
+  return tfsSessionTest(default_session, ticket, result);
+}
+
+int tfsWait(int ticket) {
+  return tfsSessionWait(default_session, ticket);
+}
+
+int tfsAsyncFd() {
+  return tfsSessionAsyncFd(default_session);
+}
+
+int tfsMount(char * sockPath) {
+
+  if (default_session != NULL)
+    return TECNICOFS_ERROR_OPEN_SESSION;
+  if ((default_session = tfsMountSession(sockPath)) == NULL)
+    return TECNICOFS_ERROR_OTHER;
   return EXIT_SUCCESS;
 }
 
 int tfsUnmount() {
 
-  close(client_sockfd);
-  unlink(client_socket_name);
-  free(client_socket_name);
+  if (default_session == NULL)
+    return TECNICOFS_ERROR_NO_OPEN_SESSION;
+  tfsUnmountSession(default_session);
+  default_session = NULL;
   return EXIT_SUCCESS;
 }
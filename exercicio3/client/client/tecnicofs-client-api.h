@@ -3,11 +3,101 @@
 
 #include "../tecnicofs-api-constants.h"
 
+/* requests a client may have waiting for a reply */
+#define MAX_IN_FLIGHT 256
+/* requests issued by the asynchronous calls that may be waiting at once */
+#define MAX_PENDING 4096
+/* lookups of each session kept while the server leases them */
+#define LOOKUP_CACHE_SLOTS 512
+
+/*
+ * Called by tfsPoll with the result of an asynchronous request
+ */
+typedef void (*tfs_callback)(int ticket, int result, void *arg);
+
+/*
+ * Commands sent to the server in a single request by tfsBatchSubmit
+ */
+typedef struct tfs_batch {
+  char buffer[MAX_MESSAGE_SIZE];
+  int size;
+  int numOps;
+} tfs_batch;
+
+/*
+ * Entry of a directory listed by tfsReaddir
+ */
+typedef struct tfs_dirent_info {
+  char name[MAX_FILE_NAME];
+  int inumber;
+  type nodeType;
+} tfs_dirent_info;
+
+/*
+ * Attributes of a node returned by tfsStat
+ */
+typedef struct tfs_stat {
+  int inumber;
+  type nodeType;
+  int size;               //entries of a directory, bytes of a file
+  unsigned generation;    //changes when the inumber is reused by another node
+} tfs_stat;
+
+/*
+ * Connection to a server, which any number of threads may use at once
+ */
+typedef struct tfs_session tfs_session;
+
+void tfsBatchBegin(tfs_batch *batch);
+int tfsBatchAdd(tfs_batch *batch, char *command);
+tfs_session *tfsMountSession(char *serverName);
+int tfsUnmountSession(tfs_session *session);
+int tfsSessionCreate(tfs_session *session, char *path, char nodeType);
+int tfsSessionDelete(tfs_session *session, char *path);
+int tfsSessionLookup(tfs_session *session, char *path);
+int tfsSessionMove(tfs_session *session, char *from, char *to);
+int tfsSessionPrint(tfs_session *session, char *file);
+int tfsSessionReaddir(tfs_session *session, char *path, int *cursor, tfs_dirent_info entries[], int max);
+int tfsSessionStat(tfs_session *session, char *path, tfs_stat *st);
+int tfsSessionTransaction(tfs_session *session, char *commands[], int numCommands);
+int tfsSessionPipeline(tfs_session *session, char *commands[], int numCommands, int results[]);
+int tfsSessionBatchSubmit(tfs_session *session, tfs_batch *batch, int results[]);
+int tfsSessionCreateAsync(tfs_session *session, char *path, char nodeType, tfs_callback callback, void *arg);
+int tfsSessionDeleteAsync(tfs_session *session, char *path, tfs_callback callback, void *arg);
+int tfsSessionLookupAsync(tfs_session *session, char *path, tfs_callback callback, void *arg);
+int tfsSessionMoveAsync(tfs_session *session, char *from, char *to, tfs_callback callback, void *arg);
+int tfsSessionPrintAsync(tfs_session *session, char *file, tfs_callback callback, void *arg);
+int tfsSessionWriteBehind(tfs_session *session, int batchSize);
+int tfsSessionFlush(tfs_session *session);
+int tfsSessionSync(tfs_session *session);
+int tfsSessionPoll(tfs_session *session);
+int tfsSessionTest(tfs_session *session, int ticket, int *result);
+int tfsSessionWait(tfs_session *session, int ticket);
+int tfsSessionAsyncFd(tfs_session *session);
+
+/* the calls below use the session opened by tfsMount */
 int tfsCreate(char *path, char nodeType);
 int tfsDelete(char *path);
 int tfsLookup(char *path);
 int tfsMove(char *from, char *to);
 int tfsPrint(char *file);
+int tfsReaddir(char *path, int *cursor, tfs_dirent_info entries[], int max);
+int tfsStat(char *path, tfs_stat *st);
+int tfsTransaction(char *commands[], int numCommands);
+int tfsPipeline(char *commands[], int numCommands, int results[]);
+int tfsBatchSubmit(tfs_batch *batch, int results[]);
+int tfsCreateAsync(char *path, char nodeType, tfs_callback callback, void *arg);
+int tfsDeleteAsync(char *path, tfs_callback callback, void *arg);
+int tfsLookupAsync(char *path, tfs_callback callback, void *arg);
+int tfsMoveAsync(char *from, char *to, tfs_callback callback, void *arg);
+int tfsPrintAsync(char *file, tfs_callback callback, void *arg);
+int tfsWriteBehind(int batchSize);
+int tfsFlush();
+int tfsSync();
+int tfsPoll();
+int tfsTest(int ticket, int *result);
+int tfsWait(int ticket);
+int tfsAsyncFd();
 int tfsMount(char *serverName);
 int tfsUnmount();
 
@@ -1,26 +1,121 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include "tecnicofs-client-api.h"
+#include "histogram.h"
 #include "../tecnicofs-api-constants.h"
 
+#define OP_TYPES 5
+#define READDIR_PAGE 16 //entries asked for by each readdir
+
 FILE* inputFile;
 char* serverName;
+int batchSize = 0; //commands sent per request (-b), 0 to send each one on its own
+tfs_batch batch;
+char batchLines[MAX_TRANSACTION_OPS][MAX_INPUT_SIZE]; //commands in the batch
+int batchCommands = 0;
+int loadThreads = 0;    //threads of the load generator (-t), 0 to replay the input once
+int loadWindow = 1;     //requests each thread keeps in flight (-w)
+int loadWarmup = 0;     //commands of each thread that are not measured (-u)
+int loadReplicate = 0;  //every thread replays the whole input (-r) instead of a part of it
+
+/*
+ * Command of the input file, replayed by the load generator
+ */
+typedef struct load_command {
+    char op;
+    char arg1[MAX_INPUT_SIZE];
+    char arg2[MAX_INPUT_SIZE];
+} load_command;
+
+/*
+ * Request of the load generator waiting for its reply
+ */
+typedef struct load_request {
+    long sent;                  //nanoseconds
+    int type;                   //index in opTokens
+    int measured;               //sent after the warm-up
+    struct load_thread *thread;
+} load_request;
+
+/*
+ * Thread of the load generator, with its own session
+ */
+typedef struct load_thread {
+    pthread_t tid;
+    tfs_session *session;
+    int first, last;            //commands replayed, from first to last - 1
+    load_request *requests;     //one for each command replayed
+    int inFlight;
+    long start, end;            //from the end of the warm-up to the last reply
+    long busy;                  //requests rejected by the server as busy
+    histogram latency[OP_TYPES];
+} load_thread;
+
+const char opTokens[] = "cldmp";
+const char *opNames[OP_TYPES] = { "create", "lookup", "delete", "move", "print" };
+load_command *loadCommands;
+int numLoadCommands = 0;
+pthread_barrier_t loadStart;
 
 static void displayUsage (const char* appName) {
-    printf("Usage: %s inputfile server_socket_name\n", appName);
+    printf("Usage: %s [-b batchsize] [-t threads [-w window] [-u warmup] [-r]] inputfile server_socket_name\n", appName);
     exit(EXIT_FAILURE);
 }
 
 static void parseArgs (long argc, char* const argv[]) {
-    if (argc != 3) {
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:t:w:u:r")) != -1) {
+        switch (opt) {
+            case 'b':
+                batchSize = atoi(optarg);
+                if (batchSize <= 0 || batchSize > MAX_TRANSACTION_OPS) {
+                    fprintf(stderr, "Error: batch size must be between 1 and %d\n", MAX_TRANSACTION_OPS);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 't':
+                if ((loadThreads = atoi(optarg)) <= 0)
+                    displayUsage(argv[0]);
+                break;
+            case 'w':
+                loadWindow = atoi(optarg);
+                if (loadWindow <= 0 || loadWindow > MAX_PENDING - MAX_IN_FLIGHT) {
+                    fprintf(stderr, "Error: window must be between 1 and %d\n", MAX_PENDING - MAX_IN_FLIGHT);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'u':
+                if ((loadWarmup = atoi(optarg)) < 0)
+                    displayUsage(argv[0]);
+                break;
+            case 'r':
+                loadReplicate = 1;
+                break;
+            default:
+                displayUsage(argv[0]);
+        }
+    }
+
+    if (batchSize > 0 && loadThreads > 0) {
+        fprintf(stderr, "Error: -b cannot be used with -t\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (argc - optind != 2) {
         fprintf(stderr, "Invalid format:\n");
         displayUsage(argv[0]);
     }
 
-    serverName = argv[2];
+    serverName = argv[optind + 1];
 
-    inputFile = fopen(argv[1], "r");
+    inputFile = fopen(argv[optind], "r");
 
     if (inputFile== NULL) {
         fprintf(stderr, "Error: cannot open input file\n");
@@ -33,13 +128,177 @@ void errorParse(){
     exit(EXIT_FAILURE);
 }
 
+/**
+ * Prints the outcome of a command.
+ * @param op: operation
+ * @param arg1: first argument
+ * @param arg2: second argument (create and move only)
+ * @param res: result of the operation
+*/
+void printResult(char op, char* arg1, char* arg2, int res) {
+    switch (op) {
+        case 'c':
+            if (arg2[0] == 'f') {
+                if (!res)
+                  printf("Created file: %s\n", arg1);
+                else
+                  printf("Unable to create file: %s\n", arg1);
+            }
+            else {
+                if (!res)
+                  printf("Created directory: %s\n", arg1);
+                else
+                  printf("Unable to create directory: %s\n", arg1);
+            }
+            break;
+        case 'l':
+            if (res >= 0)
+                printf("Search: %s found\n", arg1);
+            else
+                printf("Search: %s not found\n", arg1);
+            break;
+        case 'd':
+            if (!res)
+              printf("Deleted: %s\n", arg1);
+            else
+              printf("Unable to delete: %s\n", arg1);
+            break;
+        case 'm':
+            if (!res)
+              printf("Moved: %s to %s\n", arg1, arg2);
+            else
+              printf("Unable to move: %s to %s\n", arg1, arg2);
+            break;
+        case 'p':
+            if (!res)
+                printf("Printed tree\n");
+            else
+                printf("Unable to print tree\n");
+            break;
+        case 's':
+            if (res < 0)
+                printf("Stat: %s not found\n", arg1);
+            break;
+        case 'r':
+            if (res >= 0)
+                printf("Listed: %s, %d entries\n", arg1, res);
+            else
+                printf("Unable to list: %s\n", arg1);
+            break;
+    }
+}
+
+/**
+ * Prints the attributes of a node.
+ * @param path: path of the node
+ * @return inumber of the node or an error
+*/
+int statPath(char* path) {
+    tfs_stat st;
+    int res = tfsStat(path, &st);
+
+    if (res < 0)
+        return res;
+    if (st.nodeType == T_DIRECTORY)
+        printf("Stat: %s is directory %d (generation %u) with %d entries\n", path, st.inumber, st.generation, st.size);
+    else
+        printf("Stat: %s is file %d (generation %u) with %d bytes\n", path, st.inumber, st.generation, st.size);
+    return res;
+}
+
+/**
+ * Prints every entry of a directory, asking the server for one page at a time.
+ * @param path: path of the directory
+ * @return number of entries or an error
+*/
+int listDirectory(char* path) {
+    tfs_dirent_info entries[READDIR_PAGE];
+    int cursor = 0, total = 0, count;
+
+    do {
+        if ((count = tfsReaddir(path, &cursor, entries, READDIR_PAGE)) < 0)
+            return count;
+        for (int i = 0; i < count; i++)
+            printf("    %s %c %d\n", entries[i].name, entries[i].nodeType == T_DIRECTORY ? 'd' : 'f',
+                entries[i].inumber);
+        total += count;
+    } while (cursor != 0);
+    return total;
+}
+
+/**
+ * Sends the commands of the batch in a single request and prints the
+ * outcome of each one.
+*/
+void submitBatch() {
+    int results[MAX_TRANSACTION_OPS];
+    char op, arg1[MAX_INPUT_SIZE], arg2[MAX_INPUT_SIZE];
+
+    if (batch.numOps == 0)
+        return;
+    if (tfsBatchSubmit(&batch, results) != 0) {
+        fprintf(stderr, "Error: batch refused by the server\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < batchCommands; i++) {
+        sscanf(batchLines[i], "%c %s %s", &op, arg1, arg2);
+        printResult(op, arg1, arg2, results[i]);
+    }
+    batchCommands = 0;
+}
+
+/**
+ * Executes a command right away, or adds it to the batch with -b. A print,
+ * a listing or a stat is only executed after the commands before it.
+ * @param line: command
+ * @param op: operation
+ * @param arg1: first argument
+ * @param arg2: second argument (create and move only)
+*/
+void executeCommand(char* line, char op, char* arg1, char* arg2) {
+    int res;
+
+    if (batchSize > 0 && op != 'p' && op != 'r' && op != 's') {
+        if (tfsBatchAdd(&batch, line) <= 0)
+            errorParse();
+        strcpy(batchLines[batchCommands++], line);
+        if (batchCommands == batchSize)
+            submitBatch();
+        return;
+    }
+    submitBatch();
+
+    switch (op) {
+        case 'c':
+            res = tfsCreate(arg1, arg2[0]);
+            break;
+        case 'l':
+            res = tfsLookup(arg1);
+            break;
+        case 'd':
+            res = tfsDelete(arg1);
+            break;
+        case 'm':
+            res = tfsMove(arg1, arg2);
+            break;
+        case 'r':
+            res = listDirectory(arg1);
+            break;
+        case 's':
+            res = statPath(arg1);
+            break;
+        default:
+            res = tfsPrint(arg1);
+    }
+    printResult(op, arg1, arg2, res);
+}
+
 void *processInput() {
     char line[MAX_INPUT_SIZE];
 
     while (fgets(line, sizeof(line)/sizeof(char), inputFile)) {
         char op;
         char arg1[MAX_INPUT_SIZE], arg2[MAX_INPUT_SIZE];
-        int res;
 
         int numTokens = sscanf(line, "%c %s %s", &op, arg1, arg2);
 
@@ -53,61 +312,26 @@ void *processInput() {
                     errorParse();
                     break;
                 }
-                switch (arg2[0]) {
-                    case 'f':
-                        res = tfsCreate(arg1, 'f');
-                        if (!res)
-                          printf("Created file: %s\n", arg1);
-                        else
-                          printf("Unable to create file: %s\n", arg1);
-                        break;
-                    case 'd':
-                        res = tfsCreate(arg1, 'd');
-                        if (!res)
-                          printf("Created directory: %s\n", arg1);
-                        else
-                          printf("Unable to create directory: %s\n", arg1);
-                        break;
-                    default:
-                        fprintf(stderr, "Error: invalid node type\n");
+                if (arg2[0] != 'f' && arg2[0] != 'd') {
+                    fprintf(stderr, "Error: invalid node type\n");
+                    break;
                 }
+                executeCommand(line, op, arg1, arg2);
                 break;
             case 'l':
-                if(numTokens != 2)
-                    errorParse();
-                res = tfsLookup(arg1);
-                if (res >= 0)
-                    printf("Search: %s found\n", arg1);
-                else
-                    printf("Search: %s not found\n", arg1);
-                break;
             case 'd':
+            case 'p':
+            case 'r':
+            case 's':
                 if(numTokens != 2)
                     errorParse();
-                res = tfsDelete(arg1);
-                if (!res)
-                  printf("Deleted: %s\n", arg1);
-                else
-                  printf("Unable to delete: %s\n", arg1);
+                executeCommand(line, op, arg1, arg2);
                 break;
             case 'm':
                 if(numTokens != 3)
                     errorParse();
-                res = tfsMove(arg1, arg2);
-                if (!res)
-                  printf("Moved: %s to %s\n", arg1, arg2);
-                else
-                  printf("Unable to move: %s to %s\n", arg1, arg2);
+                executeCommand(line, op, arg1, arg2);
                 break;
-            case 'p':
-                if(numTokens != 2)
-                    errorParse();
-                res = tfsPrint(arg1);
-                if (!res)
-                    printf("Printed tree\n");
-                else
-                    printf("Unable to print tree\n");
-                break;           
             case '#':
                 break;
             default: { /* error */
@@ -115,13 +339,287 @@ void *processInput() {
             }
         }
     }
+    submitBatch();
+    fclose(inputFile);
+    return NULL;
+}
+
+/**
+ * Returns the current time of the monotonic clock in nanoseconds.
+*/
+long nowNs() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+/**
+ * Reads every command of the input file into loadCommands, validated as
+ * processInput does.
+*/
+void readCommands() {
+    char line[MAX_INPUT_SIZE];
+    int capacity = 1024;
+
+    if ((loadCommands = (load_command*) malloc(sizeof(load_command) * capacity)) == NULL) {
+        fprintf(stderr, "Error: cannot allocate the commands\n");
+        exit(EXIT_FAILURE);
+    }
+
+    while (fgets(line, sizeof(line)/sizeof(char), inputFile)) {
+        load_command *cmd = &loadCommands[numLoadCommands];
+        int numTokens = sscanf(line, "%c %s %s", &cmd->op, cmd->arg1, cmd->arg2);
+
+        if (numTokens < 1 || cmd->op == '#')
+            continue;
+        if (strchr("cldmp", cmd->op) == NULL || numTokens != (cmd->op == 'c' || cmd->op == 'm' ? 3 : 2))
+            errorParse();
+        if (cmd->op == 'c' && cmd->arg2[0] != 'f' && cmd->arg2[0] != 'd') {
+            fprintf(stderr, "Error: invalid node type\n");
+            continue;
+        }
+
+        if (++numLoadCommands == capacity) {
+            capacity *= 2;
+            if ((loadCommands = (load_command*) realloc(loadCommands, sizeof(load_command) * capacity)) == NULL) {
+                fprintf(stderr, "Error: cannot allocate the commands\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
     fclose(inputFile);
+}
+
+/**
+ * Counts the reply to a request of the load generator.
+ * @param thread: thread that sent the request
+ * @param request: request
+ * @param result: result of the operation
+*/
+void loadRecord(load_thread *thread, load_request *request, int result) {
+    if (result == TECNICOFS_ERROR_BUSY)
+        thread->busy++;
+    if (request->measured)
+        histogram_record(&thread->latency[request->type], nowNs() - request->sent);
+}
+
+/**
+ * Called by tfsSessionPoll with the result of an asynchronous request.
+*/
+void loadCallback(int ticket, int result, void *arg) {
+    load_request *request = (load_request*) arg;
+
+    request->thread->inFlight--;
+    loadRecord(request->thread, request, result);
+}
+
+/**
+ * Executes a command and waits for its result.
+ * @param session: session
+ * @param cmd: command
+ * @return result of the operation
+*/
+int loadSync(tfs_session *session, load_command *cmd) {
+    switch (cmd->op) {
+        case 'c':
+            return tfsSessionCreate(session, cmd->arg1, cmd->arg2[0]);
+        case 'l':
+            return tfsSessionLookup(session, cmd->arg1);
+        case 'd':
+            return tfsSessionDelete(session, cmd->arg1);
+        case 'm':
+            return tfsSessionMove(session, cmd->arg1, cmd->arg2);
+        default:
+            return tfsSessionPrint(session, cmd->arg1);
+    }
+}
+
+/**
+ * Sends a command without waiting for its result, which is counted by
+ * loadCallback.
+ * @param session: session
+ * @param cmd: command
+ * @param request: request, the argument of the callback
+ * @return ticket or an error
+*/
+int loadAsync(tfs_session *session, load_command *cmd, load_request *request) {
+    switch (cmd->op) {
+        case 'c':
+            return tfsSessionCreateAsync(session, cmd->arg1, cmd->arg2[0], loadCallback, request);
+        case 'l':
+            return tfsSessionLookupAsync(session, cmd->arg1, loadCallback, request);
+        case 'd':
+            return tfsSessionDeleteAsync(session, cmd->arg1, loadCallback, request);
+        case 'm':
+            return tfsSessionMoveAsync(session, cmd->arg1, cmd->arg2, loadCallback, request);
+        default:
+            return tfsSessionPrintAsync(session, cmd->arg1, loadCallback, request);
+    }
+}
+
+/**
+ * Waits until at least one asynchronous request of a thread completes.
+ * @param thread: thread
+ * @param fd: descriptor of tfsSessionAsyncFd, or -1 over shared memory
+*/
+void loadWait(load_thread *thread, int fd) {
+    int called;
+
+    do {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (fd >= 0)
+            poll(&pfd, 1, -1);
+        if ((called = tfsSessionPoll(thread->session)) < 0) {
+            fprintf(stderr, "Error: connection to the server lost\n");
+            exit(EXIT_FAILURE);
+        }
+        /* over shared memory there is nothing to wait on */
+        if (called == 0 && fd < 0)
+            sched_yield();
+    } while (called == 0);
+}
+
+/**
+ * Replays the commands of a thread, keeping up to loadWindow of them in
+ * flight. The first loadWarmup commands are not measured.
+ * @param arg: thread
+*/
+void *loadWorker(void *arg) {
+    load_thread *thread = (load_thread*) arg;
+    int fd = loadWindow > 1 ? tfsSessionAsyncFd(thread->session) : -1;
+
+    pthread_barrier_wait(&loadStart);
+    thread->start = nowNs();
+
+    for (int i = thread->first; i < thread->last; i++) {
+        load_command *cmd = &loadCommands[i];
+        load_request *request = &thread->requests[i - thread->first];
+
+        request->type = strchr(opTokens, cmd->op) - opTokens;
+        request->measured = i - thread->first >= loadWarmup;
+        request->thread = thread;
+        if (i - thread->first == loadWarmup)
+            thread->start = nowNs();
+
+        if (loadWindow == 1) {
+            request->sent = nowNs();
+            loadRecord(thread, request, loadSync(thread->session, cmd));
+            continue;
+        }
+
+        while (thread->inFlight == loadWindow)
+            loadWait(thread, fd);
+        request->sent = nowNs();
+        if (loadAsync(thread->session, cmd, request) < 0) {
+            fprintf(stderr, "Error: request could not be sent\n");
+            exit(EXIT_FAILURE);
+        }
+        thread->inFlight++;
+    }
+
+    while (thread->inFlight > 0)
+        loadWait(thread, fd);
+    thread->end = nowNs();
     return NULL;
 }
 
+/**
+ * Prints the latency percentiles of an operation type, in microseconds.
+ * @param name: operation type
+ * @param h: latencies
+*/
+void printLatency(const char *name, histogram *h) {
+    printf("%-8s %10ld %10.1f %10.1f %10.1f %10.1f\n", name, h->total,
+        histogram_percentile(h, 50) / 1e3, histogram_percentile(h, 99) / 1e3,
+        histogram_percentile(h, 99.9) / 1e3, h->max / 1e3);
+}
+
+/**
+ * Load generator: replays the input file on loadThreads threads, each with
+ * its own session, either splitting the commands between them or replaying
+ * all of them on every thread. Prints the throughput after the warm-up and
+ * the latency percentiles of each operation type.
+*/
+void runLoad() {
+    load_thread *threads;
+    histogram total[OP_TYPES], all;
+    long start = 0, end = 0, measured = 0, busy = 0;
+
+    readCommands();
+    if ((threads = (load_thread*) calloc(loadThreads, sizeof(load_thread))) == NULL) {
+        fprintf(stderr, "Error: cannot allocate the threads\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_barrier_init(&loadStart, NULL, loadThreads);
+
+    for (int i = 0; i < loadThreads; i++) {
+        load_thread *thread = &threads[i];
+
+        thread->first = loadReplicate ? 0 : (long) numLoadCommands * i / loadThreads;
+        thread->last = loadReplicate ? numLoadCommands : (long) numLoadCommands * (i + 1) / loadThreads;
+        thread->requests = (load_request*) malloc(sizeof(load_request) * (thread->last - thread->first + 1));
+        if (thread->requests == NULL || (thread->session = tfsMountSession(serverName)) == NULL) {
+            fprintf(stderr, "Unable to mount socket: %s\n", serverName);
+            exit(EXIT_FAILURE);
+        }
+        for (int t = 0; t < OP_TYPES; t++)
+            histogram_init(&thread->latency[t]);
+    }
+    for (int i = 0; i < loadThreads; i++) {
+        if (pthread_create(&threads[i].tid, NULL, loadWorker, &threads[i]) != 0) {
+            fprintf(stderr, "Error: cannot create thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (int t = 0; t < OP_TYPES; t++)
+        histogram_init(&total[t]);
+    for (int i = 0; i < loadThreads; i++) {
+        load_thread *thread = &threads[i];
+
+        pthread_join(thread->tid, NULL);
+        if (start == 0 || thread->start < start)
+            start = thread->start;
+        if (thread->end > end)
+            end = thread->end;
+        busy += thread->busy;
+        for (int t = 0; t < OP_TYPES; t++)
+            histogram_merge(&total[t], &thread->latency[t]);
+        tfsUnmountSession(thread->session);
+        free(thread->requests);
+    }
+
+    histogram_init(&all);
+    for (int t = 0; t < OP_TYPES; t++)
+        histogram_merge(&all, &total[t]);
+    measured = all.total;
+
+    printf("Threads: %d, window: %d, commands: %d%s, warm-up: %d per thread\n", loadThreads, loadWindow,
+        numLoadCommands, loadReplicate ? " on each thread" : "", loadWarmup);
+    printf("Throughput: %.0f requests/s (%ld requests in %.3f s)\n",
+        end > start ? measured / ((end - start) / 1e9) : 0.0, measured, (end - start) / 1e9);
+    printf("%-8s %10s %10s %10s %10s %10s\n", "op", "count", "p50 (us)", "p99 (us)", "p999 (us)", "max (us)");
+    for (int t = 0; t < OP_TYPES; t++)
+        if (total[t].total > 0)
+            printLatency(opNames[t], &total[t]);
+    printLatency("all", &all);
+    if (busy > 0)
+        printf("Rejected as busy: %ld\n", busy);
+
+    pthread_barrier_destroy(&loadStart);
+    free(threads);
+    free(loadCommands);
+}
+
 int main(int argc, char* argv[]) {
     parseArgs(argc, argv);
 
+    if (loadThreads > 0) {
+        runLoad();
+        exit(EXIT_SUCCESS);
+    }
+
     if (tfsMount(serverName) == 0)
       printf("Mounted! (socket = %s)\n", serverName);
     else {
@@ -129,6 +627,7 @@ int main(int argc, char* argv[]) {
       exit(EXIT_FAILURE);
     }
 
+    tfsBatchBegin(&batch);
     processInput();
 
     tfsUnmount();
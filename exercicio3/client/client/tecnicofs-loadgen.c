@@ -0,0 +1,363 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <sched.h>
+#include "tecnicofs-client-api.h"
+#include "histogram.h"
+#include "../tecnicofs-api-constants.h"
+
+#define MAX_RATES 64
+#define MAX_WINDOW (MAX_PENDING - MAX_IN_FLIGHT)
+
+/*
+ * Open-loop load generator: sends the commands of the input file, over and
+ * over, at a constant rate fixed by a schedule, whether or not the server
+ * keeps up. The latency of each request counts from the time the schedule
+ * meant to send it, so a stall of the server is charged to every request
+ * that should have been sent meanwhile (no coordinated omission).
+ */
+
+FILE* inputFile;
+char* serverName;
+long rates[MAX_RATES];      //requests per second, one run each (-r)
+int numRates = 0;
+double runSeconds = 5;      //measured seconds of each run (-d)
+double warmupSeconds = 1;   //seconds of each run that are not measured (-u)
+char *outputPrefix = NULL;  //prefix of the .hgrm files written (-o)
+
+/*
+ * Command of the input file
+ */
+typedef struct load_command {
+    char op;
+    char arg1[MAX_INPUT_SIZE];
+    char arg2[MAX_INPUT_SIZE];
+} load_command;
+
+/*
+ * Request of the schedule
+ */
+typedef struct load_request {
+    long intended;              //nanoseconds, time the schedule sends it
+    long sent;                  //nanoseconds, time it was actually sent
+    int measured;               //scheduled after the warm-up
+} load_request;
+
+load_command *commands;
+int numCommands = 0;
+
+/* state of the current run */
+histogram corrected;            //from the intended send time
+histogram uncorrected;          //from the actual send time
+long measureStart;              //intended send time of the first measured request
+long lastReply;
+int inFlight;
+long completed;
+long busy;
+
+static void displayUsage (const char* appName) {
+    printf("Usage: %s [-r rate[,rate...]] [-d seconds] [-u warmup] [-o prefix] inputfile server_socket_name\n", appName);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * Reads a list of rates separated by commas.
+ * @param list: list
+*/
+static void parseRates (char *list) {
+    for (char *rate = strtok(list, ","); rate != NULL; rate = strtok(NULL, ",")) {
+        if (numRates == MAX_RATES || (rates[numRates] = atol(rate)) <= 0) {
+            fprintf(stderr, "Error: invalid rates (at most %d, each above 0)\n", MAX_RATES);
+            exit(EXIT_FAILURE);
+        }
+        numRates++;
+    }
+}
+
+static void parseArgs (long argc, char* const argv[]) {
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:d:u:o:")) != -1) {
+        switch (opt) {
+            case 'r':
+                parseRates(optarg);
+                break;
+            case 'd':
+                if ((runSeconds = atof(optarg)) <= 0)
+                    displayUsage(argv[0]);
+                break;
+            case 'u':
+                if ((warmupSeconds = atof(optarg)) < 0)
+                    displayUsage(argv[0]);
+                break;
+            case 'o':
+                outputPrefix = optarg;
+                break;
+            default:
+                displayUsage(argv[0]);
+        }
+    }
+
+    if (argc - optind != 2) {
+        fprintf(stderr, "Invalid format:\n");
+        displayUsage(argv[0]);
+    }
+    if (numRates == 0)
+        rates[numRates++] = 1000;
+
+    serverName = argv[optind + 1];
+
+    inputFile = fopen(argv[optind], "r");
+
+    if (inputFile== NULL) {
+        fprintf(stderr, "Error: cannot open input file\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void errorParse(){
+    fprintf(stderr, "Error: command invalid\n");
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * Returns the current time of the monotonic clock in nanoseconds.
+*/
+long nowNs() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+/**
+ * Reads every command of the input file into commands.
+*/
+void readCommands() {
+    char line[MAX_INPUT_SIZE];
+    int capacity = 1024;
+
+    if ((commands = (load_command*) malloc(sizeof(load_command) * capacity)) == NULL) {
+        fprintf(stderr, "Error: cannot allocate the commands\n");
+        exit(EXIT_FAILURE);
+    }
+
+    while (fgets(line, sizeof(line)/sizeof(char), inputFile)) {
+        load_command *cmd = &commands[numCommands];
+        int numTokens = sscanf(line, "%c %s %s", &cmd->op, cmd->arg1, cmd->arg2);
+
+        if (numTokens < 1 || cmd->op == '#')
+            continue;
+        if (strchr("cldmp", cmd->op) == NULL || numTokens != (cmd->op == 'c' || cmd->op == 'm' ? 3 : 2))
+            errorParse();
+        if (cmd->op == 'c' && cmd->arg2[0] != 'f' && cmd->arg2[0] != 'd') {
+            fprintf(stderr, "Error: invalid node type\n");
+            continue;
+        }
+
+        if (++numCommands == capacity) {
+            capacity *= 2;
+            if ((commands = (load_command*) realloc(commands, sizeof(load_command) * capacity)) == NULL) {
+                fprintf(stderr, "Error: cannot allocate the commands\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    fclose(inputFile);
+
+    if (numCommands == 0) {
+        fprintf(stderr, "Error: no commands in the input file\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Called by tfsPoll with the result of a request.
+*/
+void replied(int ticket, int result, void *arg) {
+    load_request *request = (load_request*) arg;
+    long now = nowNs();
+
+    inFlight--;
+    completed++;
+    if (result == TECNICOFS_ERROR_BUSY)
+        busy++;
+    if (request->measured) {
+        histogram_record(&corrected, now - request->intended);
+        histogram_record(&uncorrected, now - request->sent);
+        lastReply = now;
+    }
+}
+
+/**
+ * Sends a command without waiting for its result.
+ * @param cmd: command
+ * @param request: request, the argument of the callback
+ * @return ticket or an error
+*/
+int sendCommand(load_command *cmd, load_request *request) {
+    switch (cmd->op) {
+        case 'c':
+            return tfsCreateAsync(cmd->arg1, cmd->arg2[0], replied, request);
+        case 'l':
+            return tfsLookupAsync(cmd->arg1, replied, request);
+        case 'd':
+            return tfsDeleteAsync(cmd->arg1, replied, request);
+        case 'm':
+            return tfsMoveAsync(cmd->arg1, cmd->arg2, replied, request);
+        default:
+            return tfsPrintAsync(cmd->arg1, replied, request);
+    }
+}
+
+/**
+ * Waits for replies until a time, or for one reply if until is 0.
+ * @param fd: descriptor of tfsAsyncFd, or -1 over shared memory
+ * @param until: nanoseconds
+*/
+void waitReplies(int fd, long until) {
+    int called;
+
+    do {
+        if (fd >= 0) {
+            struct pollfd pfd = { fd, POLLIN, 0 };
+            struct timespec timeout, *wait = NULL;
+            long left = until - nowNs();
+
+            if (until > 0) {
+                if (left <= 0)
+                    left = 0;
+                timeout.tv_sec = left / 1000000000L;
+                timeout.tv_nsec = left % 1000000000L;
+                wait = &timeout;
+            }
+            ppoll(&pfd, 1, wait, NULL);
+        }
+        if ((called = tfsPoll()) < 0) {
+            fprintf(stderr, "Error: connection to the server lost\n");
+            exit(EXIT_FAILURE);
+        }
+        /* over shared memory there is nothing to wait on */
+        if (called == 0 && fd < 0)
+            sched_yield();
+    } while (called == 0 && (until == 0 || nowNs() < until));
+}
+
+/**
+ * Sends the commands at a constant rate for the warm-up and the measured
+ * seconds, then waits for every reply. Request i is meant to be sent at
+ * start + i / rate. Requests the schedule is late for are sent right away,
+ * unless MAX_WINDOW requests are in flight, and keep their intended time.
+ * @param rate: requests per second
+ * @param fd: descriptor of tfsAsyncFd, or -1 over shared memory
+*/
+void runRate(long rate, int fd) {
+    long total = (long) (rate * (warmupSeconds + runSeconds));
+    long warmup = (long) (rate * warmupSeconds);
+    double interval = 1e9 / rate;
+    load_request *requests;
+    long start, next = 0;
+
+    if ((requests = (load_request*) malloc(sizeof(load_request) * (total + 1))) == NULL) {
+        fprintf(stderr, "Error: cannot allocate the schedule\n");
+        exit(EXIT_FAILURE);
+    }
+    histogram_init(&corrected);
+    histogram_init(&uncorrected);
+    inFlight = 0;
+    completed = 0;
+    busy = 0;
+
+    start = nowNs();
+    measureStart = start + (long) (warmup * interval);
+    lastReply = measureStart;
+
+    while (next < total) {
+        long now = nowNs();
+
+        while (next < total && inFlight < MAX_WINDOW) {
+            load_request *request = &requests[next];
+
+            request->intended = start + (long) (next * interval);
+            if (request->intended > now)
+                break;
+            request->sent = now;
+            request->measured = next >= warmup;
+            if (sendCommand(&commands[next % numCommands], request) < 0) {
+                fprintf(stderr, "Error: request could not be sent\n");
+                exit(EXIT_FAILURE);
+            }
+            inFlight++;
+            next++;
+        }
+
+        if (next == total)
+            break;
+        waitReplies(fd, inFlight < MAX_WINDOW ? requests[next].intended : 0);
+    }
+    while (inFlight > 0)
+        waitReplies(fd, 0);
+
+    free(requests);
+}
+
+/**
+ * Writes the distribution of the latencies of a run to <prefix>-<rate>.hgrm.
+ * @param rate: requests per second
+*/
+void writeDistribution(long rate) {
+    char name[MAX_INPUT_SIZE + 32];
+    FILE *out;
+
+    snprintf(name, sizeof(name), "%s-%ld.hgrm", outputPrefix, rate);
+    if ((out = fopen(name, "w")) == NULL) {
+        perror("fopen");
+        exit(EXIT_FAILURE);
+    }
+    histogram_print(out, &corrected, 1000);
+    fclose(out);
+}
+
+int main(int argc, char* argv[]) {
+    int fd;
+
+    parseArgs(argc, argv);
+    readCommands();
+
+    if (tfsMount(serverName) == 0)
+      printf("Mounted! (socket = %s)\n", serverName);
+    else {
+      fprintf(stderr, "Unable to mount socket: %s\n", serverName);
+      exit(EXIT_FAILURE);
+    }
+    fd = tfsAsyncFd();
+
+    /* one line of the latency-vs-throughput curve for each rate, in microseconds */
+    printf("%10s %10s %10s %10s %10s %10s %10s %12s\n", "target/s", "achieved/s", "p50", "p90", "p99", "p99.9",
+        "max", "p99 (sent)");
+    for (int i = 0; i < numRates; i++) {
+        double seconds;
+
+        runRate(rates[i], fd);
+        seconds = (lastReply - measureStart) / 1e9;
+        printf("%10ld %10.0f %10.1f %10.1f %10.1f %10.1f %10.1f %12.1f\n", rates[i],
+            seconds > 0 ? corrected.total / seconds : 0.0,
+            histogram_percentile(&corrected, 50) / 1e3, histogram_percentile(&corrected, 90) / 1e3,
+            histogram_percentile(&corrected, 99) / 1e3, histogram_percentile(&corrected, 99.9) / 1e3,
+            corrected.max / 1e3, histogram_percentile(&uncorrected, 99) / 1e3);
+        if (busy > 0)
+            printf("%10s rejected as busy: %ld\n", "", busy);
+        fflush(stdout);
+        if (outputPrefix != NULL)
+            writeDistribution(rates[i]);
+    }
+
+    tfsUnmount();
+    free(commands);
+
+    exit(EXIT_SUCCESS);
+}
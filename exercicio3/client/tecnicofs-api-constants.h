@@ -4,6 +4,9 @@
 
 #define MAX_FILE_NAME 100
 #define MAX_INPUT_SIZE 100
+#define MAX_TRANSACTION_OPS 256
+/* a transaction is sent as a header line followed by one command per line */
+#define MAX_MESSAGE_SIZE ((MAX_TRANSACTION_OPS + 1) * MAX_INPUT_SIZE)
 #define MAX_SOCKET_NAME 100
 #define CLIENT_SOCKET_NAME "/tmp/client"
 
@@ -33,5 +36,7 @@ typedef enum type { T_FILE, T_DIRECTORY, T_NONE } type;
 #define TECNICOFS_ERROR_INVALID_MODE -10
 /* Generic error */
 #define TECNICOFS_ERROR_OTHER -11
+/* Server is overloaded, the request was rejected without being executed */
+#define TECNICOFS_ERROR_BUSY -12
 
 #endif /* TECNICOFS_API_CONSTANTS_H */
@@ -0,0 +1,121 @@
+/* tecnicofs-protocol.h */
+#ifndef TECNICOFS_PROTOCOL_H
+#define TECNICOFS_PROTOCOL_H
+
+#include <stdint.h>
+#include "tecnicofs-api-constants.h"
+
+/*
+ * Binary format of the requests and replies.
+ * Every request starts with a fixed header followed by the paths, each one
+ * ended by '\0' so that it can be used in place. The first byte of a text
+ * request is always a letter, so the magic number tells both formats apart.
+ * Messages never leave the machine (AF_UNIX), integers use the host byte order.
+ */
+#define TFS_MAGIC 0xF5
+#define TFS_VERSION 1
+
+/* opcodes */
+#define TFS_OP_CREATE 1
+#define TFS_OP_DELETE 2
+#define TFS_OP_LOOKUP 3
+#define TFS_OP_MOVE 4
+#define TFS_OP_PRINT 5
+#define TFS_OP_TRANSACTION 6
+#define TFS_OP_MOUNT 7            /* path: name of a shared memory segment (tecnicofs-shm.h) */
+#define TFS_OP_BATCH 8            /* operations executed in order, each one on its own */
+#define TFS_OP_READDIR 9          /* path: directory, followed by tfs_readdir_args */
+#define TFS_OP_STAT 10            /* path: node whose attributes are returned */
+
+/* flags */
+#define TFS_FLAG_DIRECTORY 0x01   /* create a directory instead of a file */
+#define TFS_FLAG_LEASE 0x02       /* lookup: asks for a lease, delete and move: skip the leases of the owner */
+
+typedef struct tfs_header {
+	uint8_t magic;
+	uint8_t version;
+	uint8_t opcode;
+	uint8_t flags;
+	uint32_t request_id;     /* echoed in the reply */
+	uint32_t size;           /* bytes after the header */
+	uint16_t length[2];      /* length of each path without the '\0', 0 if absent */
+} tfs_header;
+
+/*
+ * The paths follow the header: path[0] '\0' path[1] '\0', and then the
+ * 32-bit id of the client (lease owner) if TFS_FLAG_LEASE is set.
+ * A transaction carries instead its operations, each one a complete request
+ * (header and paths) and length[0] is the number of operations. So does a
+ * batch, whose operations may also be lookups and are not applied atomically.
+ */
+
+/*
+ * Arguments of a readdir, after its path: cursor 0 starts the listing, the
+ * cursor of the previous reply resumes it
+ */
+typedef struct tfs_readdir_args {
+	uint32_t cursor;
+	uint32_t count;          /* entries wanted, at most TFS_READDIR_MAX_ENTRIES */
+} tfs_readdir_args;
+
+#define TFS_READDIR_MAX_ENTRIES 32
+
+typedef struct tfs_reply {
+	uint8_t magic;
+	uint8_t version;
+	uint8_t opcode;
+	uint8_t flags;
+	uint32_t request_id;
+	int32_t result;
+} tfs_reply;
+
+/*
+ * Reply to a lookup granted a lease, with TFS_FLAG_LEASE set in its flags:
+ * the client may answer the lookup from its cache for duration microseconds
+ * after sending the request, as deletes and moves of the path wait for it
+ */
+typedef struct tfs_lease_reply {
+	tfs_reply reply;
+	uint32_t duration;
+} tfs_lease_reply;
+
+/*
+ * Reply to a batch: the result is the number of operations executed, and
+ * the result of each one follows, in order
+ */
+typedef struct tfs_batch_reply {
+	tfs_reply reply;
+	int32_t results[MAX_TRANSACTION_OPS];
+} tfs_batch_reply;
+
+/*
+ * Reply to a readdir: the result is the number of entries, which follow the
+ * cursor of the next page (0 once the listing is complete). Each entry is a
+ * tfs_dirent followed by its name and a '\0', without padding, and a page
+ * holds the entries that fit in TFS_MAX_REPLY_SIZE
+ */
+typedef struct tfs_readdir_reply {
+	tfs_reply reply;
+	uint32_t cursor;
+} tfs_readdir_reply;
+
+typedef struct tfs_dirent {
+	int32_t inumber;
+	uint8_t type;            /* T_FILE or T_DIRECTORY */
+	uint8_t length;          /* of the name, without the '\0' */
+} tfs_dirent;
+
+/*
+ * Reply to a stat of a node that exists: the result is its inumber
+ */
+typedef struct tfs_stat_reply {
+	tfs_reply reply;
+	uint32_t type;           /* T_FILE or T_DIRECTORY */
+	uint32_t size;           /* entries of a directory, bytes of a file */
+	uint32_t generation;     /* changes when the inumber is reused by another node */
+} tfs_stat_reply;
+
+/* size of the largest reply */
+#define TFS_MAX_REPLY_SIZE sizeof(tfs_batch_reply)
+
+#endif /* TECNICOFS_PROTOCOL_H */
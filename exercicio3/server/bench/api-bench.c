@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../../client/client/tecnicofs-client-api.h"
+
+char *serverName;
+
+int compareLong(const void *a, const void *b) {
+    long x = *(const long *) a, y = *(const long *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Measures the round trip of tfsLookup through the client library, over the
+ * socket or over shared memory if TECNICOFS_SHARED_MEMORY is set, or the
+ * latency of tfsLookup in the embedded library (api-bench-embedded, built
+ * with TFS_EMBEDDED, which ignores the socket name).
+ * Usage: ./api-bench socketname iterations
+*/
+int main(int argc, char* argv[]) {
+
+    if (argc != 3 || atoi(argv[2]) <= 0) {
+        fprintf(stderr, "Usage: %s socketname iterations\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    serverName = argv[1];
+    int iterations = atoi(argv[2]);
+    long *latency = (long*) malloc(sizeof(long) * iterations);
+    struct timespec start, end;
+
+    tfsMount(serverName);
+    tfsCreate("/a", 'd');
+
+    for (int i = 0; i < iterations; i++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        tfsLookup("/a");
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        latency[i] = (end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec);
+    }
+    tfsUnmount();
+
+    qsort(latency, iterations, sizeof(long), compareLong);
+#ifdef TFS_EMBEDDED
+    char *transport = "embedded";
+#else
+    char *transport = getenv("TECNICOFS_SHARED_MEMORY") ? "shm" : "socket";
+#endif
+    printf("%s lookups=%d p50=%.2fus p99=%.2fus\n", transport,
+            iterations, latency[iterations / 2] / 1e3, latency[(long) iterations * 99 / 100] / 1e3);
+
+    free(latency);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../../client/client/tecnicofs-client-api.h"
+
+#define BURST_FILE "/tmp/burst-bench.out"
+
+char *serverName;
+
+int compareLong(const void *a, const void *b) {
+    long x = *(const long *) a, y = *(const long *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Sends a burst of prints, all in flight at the same time, counting the ones
+ * the server rejected.
+ * @param numPrints: number of prints
+*/
+void burst(int numPrints) {
+    char **commands = (char**) malloc(sizeof(char*) * numPrints);
+    int *results = (int*) malloc(sizeof(int) * numPrints);
+    int busy = 0;
+
+    for (int i = 0; i < numPrints; i++)
+        commands[i] = "p " BURST_FILE;
+    tfsMount(serverName);
+    tfsPipeline(commands, numPrints, results);
+    tfsUnmount();
+
+    for (int i = 0; i < numPrints; i++)
+        if (results[i] == TECNICOFS_ERROR_BUSY)
+            busy++;
+    printf("prints=%d busy=%d\n", numPrints, busy);
+    free(commands);
+    free(results);
+}
+
+/**
+ * Measures the latency of lookups while another client floods the server
+ * with prints.
+ * Usage: ./burst-bench socketname lookups prints
+*/
+int main(int argc, char* argv[]) {
+
+    if (argc != 4 || atoi(argv[2]) <= 0 || atoi(argv[3]) <= 0) {
+        fprintf(stderr, "Usage: %s socketname lookups prints\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    serverName = argv[1];
+    int lookups = atoi(argv[2]);
+    long *latency = (long*) malloc(sizeof(long) * lookups);
+    struct timespec start, end;
+    pid_t pid;
+
+    tfsMount(serverName);
+    tfsCreate("/a", 'd');
+
+    if ((pid = fork()) == 0) {
+        burst(atoi(argv[3]));
+        exit(EXIT_SUCCESS);
+    }
+
+    for (int i = 0; i < lookups; i++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        tfsLookup("/a");
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        latency[i] = (end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec);
+    }
+    tfsUnmount();
+    waitpid(pid, NULL, 0);
+
+    qsort(latency, lookups, sizeof(long), compareLong);
+    printf("lookups=%d p50=%.1fus p99=%.1fus max=%.1fus\n", lookups, latency[lookups / 2] / 1e3,
+            latency[(long) lookups * 99 / 100] / 1e3, latency[lookups - 1] / 1e3);
+
+    unlink(BURST_FILE);
+    free(latency);
+    exit(EXIT_SUCCESS);
+}
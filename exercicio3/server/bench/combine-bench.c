@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "../fs/operations.h"
+
+int stop = 0;
+long total_ops = 0;
+
+/**
+ * Creates and deletes a file of its own in the hot directory until the benchmark stops.
+ * @param arg: index of the thread
+*/
+void *createDeleteLoop(void *arg){
+    long ops = 0;
+    char name[MAX_FILE_NAME];
+
+    sprintf(name, "/hot/f%ld", (long) arg);
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        create(name, T_FILE);
+        delete(name);
+        ops += 2;
+    }
+    __atomic_fetch_add(&total_ops, ops, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+/**
+ * Measures create/delete throughput of many threads in the same directory.
+ * Usage: ./combine-bench numthreads seconds lock|combine
+*/
+int main(int argc, char* argv[]) {
+
+    if (argc != 4 || atoi(argv[1]) <= 0 || atoi(argv[2]) <= 0 ||
+            (strcmp(argv[3], "lock") && strcmp(argv[3], "combine"))) {
+        fprintf(stderr, "Usage: %s numthreads seconds lock|combine\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    int numthreads = atoi(argv[1]);
+    int seconds = atoi(argv[2]);
+
+    /* every thread keeps at most one entry in the directory */
+    if (numthreads > MAX_DIR_ENTRIES) {
+        fprintf(stderr, "Error: at most %d threads\n", MAX_DIR_ENTRIES);
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_t* tid = (pthread_t*) malloc(sizeof(pthread_t) * numthreads);
+
+    init_fs();
+    create("/hot", T_DIRECTORY);
+    combining_dirs = !strcmp(argv[3], "combine");
+
+    for (long i = 0; i < numthreads; i++) {
+        if (pthread_create(&tid[i], NULL, createDeleteLoop, (void*) i) != 0) {
+            fprintf(stderr, "Error: creating threads\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    sleep(seconds);
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+
+    for (int i = 0; i < numthreads; i++)
+        pthread_join(tid[i], NULL);
+
+    printf("%s threads=%d ops/s=%.0f\n", argv[3], numthreads, (double) total_ops / seconds);
+
+    free(tid);
+    destroy_fs();
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "../fs/operations.h"
+
+int stop = 0;
+int announce = 0;
+int mutate = 0;
+long total_requests = 0;
+long total_failures = 0;
+
+/**
+ * Runs requests until the benchmark stops, announcing an epoch per request
+ * like the server does if announce is set.
+ * @param arg: index of the thread
+*/
+void *requestLoop(void *arg){
+    long requests = 0, failures = 0;
+    char name[MAX_FILE_NAME];
+
+    sprintf(name, "/dir/f%ld", (long) arg);
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        if (announce)
+            ebr_enter();
+        if (mutate) {
+            /* the delete retires the inode */
+            if (create(name, T_FILE) == FAIL)
+                failures++;
+            else
+                delete(name);
+        }
+        else
+            lookup("/dir", 'u');
+        if (announce)
+            ebr_exit();
+        requests++;
+    }
+    __atomic_fetch_add(&total_requests, requests, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&total_failures, failures, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+/**
+ * Measures the overhead of epoch based reclamation on the request loop.
+ * Usage: ./ebr-bench numthreads seconds lookup|mutate none|ebr
+*/
+int main(int argc, char* argv[]) {
+
+    if (argc != 5 || atoi(argv[1]) <= 0 || atoi(argv[2]) <= 0 ||
+            (strcmp(argv[3], "lookup") && strcmp(argv[3], "mutate")) ||
+            (strcmp(argv[4], "none") && strcmp(argv[4], "ebr"))) {
+        fprintf(stderr, "Usage: %s numthreads seconds lookup|mutate none|ebr\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    int numthreads = atoi(argv[1]);
+    int seconds = atoi(argv[2]);
+    mutate = !strcmp(argv[3], "mutate");
+    announce = !strcmp(argv[4], "ebr");
+
+    if (mutate && numthreads > MAX_DIR_ENTRIES) {
+        fprintf(stderr, "Error: at most %d threads\n", MAX_DIR_ENTRIES);
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_t* tid = (pthread_t*) malloc(sizeof(pthread_t) * numthreads);
+
+    init_fs();
+    create("/dir", T_DIRECTORY);
+
+    /* creates fail while every free inode waits for a reader, the fs messages go away */
+    if (freopen("/dev/null", "w", stdout) == NULL) {
+        fprintf(stderr, "Error: cannot redirect stdout\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (long i = 0; i < numthreads; i++) {
+        if (pthread_create(&tid[i], NULL, requestLoop, (void*) i) != 0) {
+            fprintf(stderr, "Error: creating threads\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    sleep(seconds);
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+
+    for (int i = 0; i < numthreads; i++)
+        pthread_join(tid[i], NULL);
+
+    fprintf(stderr, "%s %s threads=%d requests/s=%.0f failed creates=%ld\n", argv[3], argv[4],
+            numthreads, (double) total_requests / seconds, total_failures);
+
+    free(tid);
+    destroy_fs();
+    exit(EXIT_SUCCESS);
+}
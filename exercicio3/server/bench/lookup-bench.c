@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "../fs/operations.h"
+
+int stop = 0;
+long total_lookups = 0;
+
+/**
+ * Looks up the same path until the benchmark stops.
+*/
+void *lookupLoop(){
+    long lookups = 0;
+
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        lookup("/a/b/c", 'u');
+        lookups++;
+    }
+    __atomic_fetch_add(&total_lookups, lookups, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+/**
+ * Measures lookup throughput with the root using a regular rwlock or a
+ * big-reader lock.
+ * Usage: ./lookup-bench numthreads seconds rwlock|brlock
+*/
+int main(int argc, char* argv[]) {
+
+    if (argc != 4 || atoi(argv[1]) <= 0 || atoi(argv[2]) <= 0 ||
+            (strcmp(argv[3], "rwlock") && strcmp(argv[3], "brlock"))) {
+        fprintf(stderr, "Usage: %s numthreads seconds rwlock|brlock\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    int numthreads = atoi(argv[1]);
+    int seconds = atoi(argv[2]);
+    pthread_t* tid = (pthread_t*) malloc(sizeof(pthread_t) * numthreads);
+
+    init_fs();
+    if (!strcmp(argv[3], "rwlock"))
+        inode_set_big_reader(FS_ROOT, 0);
+
+    create("/a", T_DIRECTORY);
+    create("/a/b", T_DIRECTORY);
+    create("/a/b/c", T_FILE);
+
+    for (int i = 0; i < numthreads; i++) {
+        if (pthread_create(&tid[i], NULL, lookupLoop, NULL) != 0) {
+            fprintf(stderr, "Error: creating threads\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    sleep(seconds);
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+
+    for (int i = 0; i < numthreads; i++)
+        pthread_join(tid[i], NULL);
+
+    printf("%s threads=%d lookups/s=%.0f\n", argv[3], numthreads, (double) total_lookups / seconds);
+
+    free(tid);
+    destroy_fs();
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../protocol.h"
+
+#define ITERATIONS 10000000
+
+/**
+ * Encodes a request of the binary format like the client library does.
+ * @param buffer: where the request is written
+ * @param opcode: operation
+ * @param flags: flags of the operation
+ * @param path: first path
+ * @param dest: second path or NULL
+ * @return size of the request
+*/
+int encode(char *buffer, uint8_t opcode, uint8_t flags, char *path, char *dest) {
+    tfs_header header = { TFS_MAGIC, TFS_VERSION, opcode, flags, 1, 0, { 0, 0 } };
+    char *paths[2] = { path, dest };
+    int size = sizeof(tfs_header);
+
+    for (int i = 0; i < 2 && paths[i] != NULL; i++) {
+        header.length[i] = strlen(paths[i]);
+        memcpy(buffer + size, paths[i], header.length[i] + 1);
+        size += header.length[i] + 1;
+    }
+    header.size = size - sizeof(tfs_header);
+    memcpy(buffer, &header, sizeof(tfs_header));
+    return size;
+}
+
+/**
+ * Parses the same request many times.
+ * @return nanoseconds per request
+*/
+double measure(char *input, int length) {
+    struct timespec start, end;
+    parsed_request req;
+    long failures = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < ITERATIONS; i++) {
+        if (parseRequest(input, length, &req) == FAIL)
+            failures++;
+        /* the parsed request must not be optimized away */
+        __asm__ volatile("" : : "r" (&req) : "memory");
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (failures) {
+        fprintf(stderr, "Error: request could not be parsed\n");
+        exit(EXIT_FAILURE);
+    }
+    return ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / ITERATIONS;
+}
+
+/**
+ * Measures the parse cost of each request in the text and in the binary format.
+ * Usage: ./parse-bench
+*/
+int main() {
+    char binary[sizeof(tfs_header) + 2 * MAX_FILE_NAME];
+    struct {
+        char *name, *text;
+        uint8_t opcode, flags;
+        char *path, *dest;
+    } requests[] = {
+        { "create", "c /dir/subdir/file f", TFS_OP_CREATE, 0, "/dir/subdir/file", NULL },
+        { "lookup", "l /dir/subdir/file", TFS_OP_LOOKUP, 0, "/dir/subdir/file", NULL },
+        { "move", "m /dir/subdir/file /dir/other/file", TFS_OP_MOVE, 0, "/dir/subdir/file", "/dir/other/file" },
+    };
+
+    for (int i = 0; i < sizeof(requests) / sizeof(requests[0]); i++) {
+        int length = encode(binary, requests[i].opcode, requests[i].flags, requests[i].path, requests[i].dest);
+        printf("%s text=%.1fns binary=%.1fns\n", requests[i].name,
+            measure(requests[i].text, strlen(requests[i].text)), measure(binary, length));
+    }
+    exit(EXIT_SUCCESS);
+}
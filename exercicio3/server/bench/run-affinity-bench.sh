@@ -0,0 +1,26 @@
+#!/bin/bash
+# Lookup throughput of the server with its threads free to migrate and with
+# each thread pinned to a CPU of the list (one after the other)
+# Usage: ./run-affinity-bench.sh [numthreads] [clients] [seconds] [cpulist]
+
+NUMTHREADS=${1:-4}
+CLIENTS=${2:-8}
+SECONDS_PER_RUN=${3:-2}
+CPUS=${4:-0-$(($(nproc) - 1))}
+SOCKET=/tmp/affinity-bench-tfs
+
+for BACKEND in blocking batch epoll
+do
+    for PIN in "" "-a $CPUS"
+    do
+        ./tecnicofs-nodelay -i "$BACKEND" $PIN "$NUMTHREADS" "$SOCKET" > /dev/null 2> affinity-bench.stats &
+        SERVER=$!
+        sleep 0.2
+        echo -n "$BACKEND ${PIN:-unpinned} "
+        ./server-bench "$SOCKET" "$CLIENTS" "$SECONDS_PER_RUN"
+        kill -TERM "$SERVER"
+        wait "$SERVER"
+        grep -E "context switches|per cpu second" affinity-bench.stats | sed 's/^/    /'
+    done
+done
+rm -f affinity-bench.stats
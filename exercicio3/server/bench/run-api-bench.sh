@@ -0,0 +1,16 @@
+#!/bin/bash
+# Round trip of tfsLookup over the socket and over shared memory, and
+# latency of tfsLookup in the embedded library
+# Usage: ./run-api-bench.sh [iterations]
+
+ITERATIONS=${1:-100000}
+SOCKET=/tmp/api-bench-tfs
+
+./tecnicofs-nodelay 1 "$SOCKET" > /dev/null 2> /dev/null &
+SERVER=$!
+sleep 0.2
+./api-bench "$SOCKET" "$ITERATIONS"
+TECNICOFS_SHARED_MEMORY=1 ./api-bench "$SOCKET" "$ITERATIONS"
+kill -TERM "$SERVER"
+wait "$SERVER"
+./api-bench-embedded - "$ITERATIONS"
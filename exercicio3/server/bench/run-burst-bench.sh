@@ -0,0 +1,22 @@
+#!/bin/bash
+# Lookup latency while another client floods the server with prints, with the
+# default class limits and with every class unlimited
+# Usage: ./run-burst-bench.sh [numthreads] [lookups] [prints]
+
+NUMTHREADS=${1:-4}
+LOOKUPS=${2:-20000}
+PRINTS=${3:-5000}
+SOCKET=/tmp/burst-bench-tfs
+
+for LIMITS in "" "-Q 256,256,256 -L $NUMTHREADS,$NUMTHREADS,$NUMTHREADS"
+do
+    ./tecnicofs-nodelay -i seqpacket $LIMITS "$NUMTHREADS" "$SOCKET" > /dev/null 2> burst-bench.stats &
+    SERVER=$!
+    sleep 0.2
+    echo "limits: ${LIMITS:-default}"
+    ./burst-bench "$SOCKET" "$LOOKUPS" "$PRINTS"
+    kill -TERM "$SERVER"
+    wait "$SERVER"
+    grep rejected burst-bench.stats
+done
+rm -f burst-bench.stats
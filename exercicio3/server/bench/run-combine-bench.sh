@@ -0,0 +1,16 @@
+#!/bin/bash
+# Create/delete throughput in a single hot directory, with and without combining
+# Usage: ./run-combine-bench.sh [maxthreads] [seconds]
+
+MAXTHREADS=${1:-16}
+SECONDS_PER_RUN=${2:-2}
+
+for LOCK in lock combine
+do
+    THREADS=1
+    while [ "$THREADS" -le "$MAXTHREADS" ]
+    do
+        ./combine-bench "$THREADS" "$SECONDS_PER_RUN" "$LOCK"
+        THREADS=$((THREADS * 2))
+    done
+done
@@ -0,0 +1,19 @@
+#!/bin/bash
+# Request loop throughput with and without an epoch announced per request
+# Usage: ./run-ebr-bench.sh [maxthreads] [seconds]
+
+MAXTHREADS=${1:-16}
+SECONDS_PER_RUN=${2:-2}
+
+for OP in lookup mutate
+do
+    for MODE in none ebr
+    do
+        THREADS=1
+        while [ "$THREADS" -le "$MAXTHREADS" ]
+        do
+            ./ebr-bench "$THREADS" "$SECONDS_PER_RUN" "$OP" "$MODE"
+            THREADS=$((THREADS * 2))
+        done
+    done
+done
@@ -0,0 +1,16 @@
+#!/bin/bash
+# Lookup throughput of the root rwlock against the big-reader lock
+# Usage: ./run-lookup-bench.sh [maxthreads] [seconds]
+
+MAXTHREADS=${1:-64}
+SECONDS_PER_RUN=${2:-2}
+
+for LOCK in rwlock brlock
+do
+    THREADS=1
+    while [ "$THREADS" -le "$MAXTHREADS" ]
+    do
+        ./lookup-bench "$THREADS" "$SECONDS_PER_RUN" "$LOCK"
+        THREADS=$((THREADS * 2))
+    done
+done
@@ -0,0 +1,29 @@
+#!/bin/bash
+# Lookup throughput and latency of the server with each I/O backend, the
+# statistics of the server give the requests served per CPU second
+# Usage: ./run-server-bench.sh [numthreads] [maxclients] [seconds] [batchsize]
+
+NUMTHREADS=${1:-4}
+MAXCLIENTS=${2:-16}
+SECONDS_PER_RUN=${3:-2}
+BATCH=${4:-16}
+SOCKET=/tmp/server-bench-tfs
+
+for BACKEND in blocking epoll batch seqpacket uring
+do
+    CLIENTS=1
+    while [ "$CLIENTS" -le "$MAXCLIENTS" ]
+    do
+        ./tecnicofs-nodelay -i "$BACKEND" -k "$BATCH" "$NUMTHREADS" "$SOCKET" > /dev/null 2> server-bench.stats &
+        SERVER=$!
+        sleep 0.2
+        echo -n "$BACKEND threads=$NUMTHREADS "
+        ./server-bench "$SOCKET" "$CLIENTS" "$SECONDS_PER_RUN"
+        kill -TERM "$SERVER"
+        wait "$SERVER"
+        # statistics printed by the server on exit
+        sed 's/^/    /' server-bench.stats
+        CLIENTS=$((CLIENTS * 2))
+    done
+done
+rm -f server-bench.stats
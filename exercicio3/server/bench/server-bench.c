@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "../tecnicofs-api-constants.h"
+
+#define MAX_SAMPLES (1 << 20)
+#define BENCH_SOCKET_NAME "/tmp/server-bench"
+
+char *serverName;
+char *command = "l /a";
+int stop = 0;
+int connected = 0;  //set if the server takes connections
+
+/*
+ * Latencies measured by one client, in nanoseconds
+ */
+typedef struct client_samples {
+    long index;
+    long *latency;
+    long count;
+} client_samples;
+
+/**
+ * Resets and set socket address.
+ * @param path: socket name
+ * @param addr: socket address
+*/
+int setSockAddrUn(char *path, struct sockaddr_un *addr) {
+    bzero((char *)addr, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+    return SUN_LEN(addr);
+}
+
+/**
+ * Opens a client socket, connected if the server takes connections or else
+ * with a name unique to the client.
+ * @param index: index of the client
+*/
+int openClient(long index) {
+    int fd;
+    socklen_t addrlen;
+    struct sockaddr_un addr;
+    char name[MAX_FILE_NAME];
+
+    addrlen = setSockAddrUn(serverName, &addr);
+    if ((fd = socket(AF_UNIX, SOCK_SEQPACKET, 0)) >= 0 && connect(fd, (struct sockaddr *) &addr, addrlen) == 0) {
+        connected = 1;
+        return fd;
+    }
+    if (fd >= 0)
+        close(fd);
+
+    sprintf(name, "%s%d-%ld", BENCH_SOCKET_NAME, getpid(), index);
+    unlink(name);
+    addrlen = setSockAddrUn(name, &addr);
+    if ((fd = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0 || bind(fd, (struct sockaddr *) &addr, addrlen) < 0) {
+        perror("server-bench: socket error");
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+/**
+ * Closes a client socket and removes its name.
+ * @param fd: client socket
+ * @param index: index of the client
+*/
+void closeClient(int fd, long index) {
+    char name[MAX_FILE_NAME];
+
+    sprintf(name, "%s%d-%ld", BENCH_SOCKET_NAME, getpid(), index);
+    close(fd);
+    if (!connected)
+        unlink(name);
+}
+
+/**
+ * Sends a command and waits for the result.
+ * @param fd: client socket
+ * @param cmd: command
+*/
+int request(int fd, char *cmd) {
+    int result;
+    struct sockaddr_un serv_addr;
+    socklen_t servlen = setSockAddrUn(serverName, &serv_addr);
+
+    if ((connected ? send(fd, cmd, strlen(cmd) + 1, 0) :
+            sendto(fd, cmd, strlen(cmd) + 1, 0, (struct sockaddr *) &serv_addr, servlen)) < 0 ||
+            recvfrom(fd, &result, sizeof(result), 0, NULL, NULL) < 0) {
+        perror("server-bench: request error");
+        exit(EXIT_FAILURE);
+    }
+    return result;
+}
+
+/**
+ * Closed loop client: sends the next request as soon as the last one is answered.
+ * @param arg: samples of the client
+*/
+void *clientLoop(void *arg) {
+    client_samples *samples = (client_samples *) arg;
+    int fd = openClient(samples->index);
+    struct timespec start, end;
+
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        request(fd, command);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if (samples->count < MAX_SAMPLES)
+            samples->latency[samples->count] = (end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec);
+        samples->count++;
+    }
+    closeClient(fd, samples->index);
+    return NULL;
+}
+
+int compareLong(const void *a, const void *b) {
+    long x = *(const long *) a, y = *(const long *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Measures the throughput and round trip latency of a running server.
+ * Usage: ./server-bench socketname numclients seconds [command]
+*/
+int main(int argc, char* argv[]) {
+
+    if ((argc != 4 && argc != 5) || atoi(argv[2]) <= 0 || atoi(argv[3]) <= 0) {
+        fprintf(stderr, "Usage: %s socketname numclients seconds [command]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    serverName = argv[1];
+    int numclients = atoi(argv[2]);
+    int seconds = atoi(argv[3]);
+    if (argc == 5)
+        command = argv[4];
+
+    /* the looked up directory must exist */
+    int fd = openClient(-1);
+    request(fd, "c /a d");
+    closeClient(fd, -1);
+
+    pthread_t* tid = (pthread_t*) malloc(sizeof(pthread_t) * numclients);
+    client_samples* samples = (client_samples*) calloc(numclients, sizeof(client_samples));
+
+    for (int i = 0; i < numclients; i++) {
+        samples[i].index = i;
+        samples[i].latency = (long*) malloc(sizeof(long) * MAX_SAMPLES);
+        if (pthread_create(&tid[i], NULL, clientLoop, &samples[i]) != 0) {
+            fprintf(stderr, "Error: creating threads\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    sleep(seconds);
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+
+    long total = 0, kept = 0;
+    for (int i = 0; i < numclients; i++) {
+        pthread_join(tid[i], NULL);
+        total += samples[i].count;
+    }
+
+    /* the percentiles come from every sample kept by the clients */
+    long *all = (long*) malloc(sizeof(long) * (total > 0 ? total : 1));
+    for (int i = 0; i < numclients; i++) {
+        long count = samples[i].count < MAX_SAMPLES ? samples[i].count : MAX_SAMPLES;
+        memcpy(all + kept, samples[i].latency, sizeof(long) * count);
+        kept += count;
+        free(samples[i].latency);
+    }
+    qsort(all, kept, sizeof(long), compareLong);
+
+    printf("clients=%d requests/s=%.0f p50=%.1fus p99=%.1fus\n", numclients, (double) total / seconds,
+            kept ? all[kept / 2] / 1e3 : 0.0, kept ? all[kept * 99 / 100] / 1e3 : 0.0);
+
+    free(all);
+    free(samples);
+    free(tid);
+    exit(EXIT_SUCCESS);
+}
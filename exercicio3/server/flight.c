@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "flight.h"
+
+/*
+ * Request being executed, shared by the identical requests that arrive
+ * before it completes. The last thread to read the result frees it.
+ */
+typedef struct flight {
+	struct flight *next;
+	pthread_cond_t finished;
+	int done;
+	int result;
+	int refs;
+	char key[];
+} flight;
+
+typedef struct flight_bucket {
+	pthread_mutex_t mutex;
+	flight *head;
+} flight_bucket;
+
+static flight_bucket buckets[FLIGHT_BUCKETS];
+
+/**
+ * Initializes the table of requests in flight.
+*/
+void flight_init() {
+	for (int i = 0; i < FLIGHT_BUCKETS; i++) {
+		if (pthread_mutex_init(&buckets[i].mutex, NULL) != 0) {
+			fprintf(stderr, "Error: mutex init error\n");
+			exit(EXIT_FAILURE);
+		}
+		buckets[i].head = NULL;
+	}
+}
+
+/**
+ * Hashes the key of a request (djb2).
+ * @param key: key
+*/
+static unsigned flight_hash(char *key) {
+	unsigned hash = 5381;
+
+	while (*key != '\0')
+		hash = hash * 33 + (unsigned char) *key++;
+	return hash % FLIGHT_BUCKETS;
+}
+
+/**
+ * Drops a reference to a request in flight.
+ * @param f: request, whose bucket is locked
+*/
+static void flight_release(flight *f) {
+	if (--f->refs == 0) {
+		pthread_cond_destroy(&f->finished);
+		free(f);
+	}
+}
+
+/**
+ * Executes a read-only request, unless an identical one is already being
+ * executed: then waits for it and returns its result, which comes from an
+ * execution that overlapped the request.
+ * @param key: request, which identifies its duplicates
+ * @param function: executes the request
+ * @param shared: set to 1 if the result was taken from another request
+ * @return result of the request
+*/
+int flight_do(char *key, flight_function function, int *shared) {
+	flight_bucket *bucket = &buckets[flight_hash(key)];
+	flight *f;
+	int result;
+
+	pthread_mutex_lock(&bucket->mutex);
+	for (f = bucket->head; f != NULL; f = f->next) {
+		if (!strcmp(f->key, key))
+			break;
+	}
+
+	/* a duplicate waits for the request in flight */
+	if (f != NULL) {
+		f->refs++;
+		while (!f->done)
+			pthread_cond_wait(&f->finished, &bucket->mutex);
+		result = f->result;
+		flight_release(f);
+		pthread_mutex_unlock(&bucket->mutex);
+		*shared = 1;
+		return result;
+	}
+
+	if ((f = (flight *) malloc(sizeof(flight) + strlen(key) + 1)) == NULL) {
+		fprintf(stderr, "Error: flight allocation error\n");
+		exit(EXIT_FAILURE);
+	}
+	strcpy(f->key, key);
+	pthread_cond_init(&f->finished, NULL);
+	f->done = 0;
+	f->refs = 1;
+	f->next = bucket->head;
+	bucket->head = f;
+	pthread_mutex_unlock(&bucket->mutex);
+
+	result = function(key);
+
+	/* requests that arrive from now on execute again */
+	pthread_mutex_lock(&bucket->mutex);
+	flight **prev = &bucket->head;
+	while (*prev != f)
+		prev = &(*prev)->next;
+	*prev = f->next;
+	f->result = result;
+	f->done = 1;
+	pthread_cond_broadcast(&f->finished);
+	flight_release(f);
+	pthread_mutex_unlock(&bucket->mutex);
+
+	*shared = 0;
+	return result;
+}
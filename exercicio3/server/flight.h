@@ -0,0 +1,14 @@
+#ifndef FLIGHT_H
+#define FLIGHT_H
+
+#define FLIGHT_BUCKETS 64
+
+/*
+ * Read-only request executed once for every identical request in flight
+ */
+typedef int (*flight_function)(char *key);
+
+void flight_init();
+int flight_do(char *key, flight_function function, int *shared);
+
+#endif /* FLIGHT_H */
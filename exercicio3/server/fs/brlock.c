@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include "brlock.h"
+
+__thread int brlock_thread_index = -1; /* slot used by this thread when reading */
+int brlock_next_slot = 0;
+
+/**
+ * Initializes a big-reader lock.
+ * @param brl: big-reader lock
+*/
+void brlock_init(brlock *brl) {
+    for (int i = 0; i < BRLOCK_SLOTS; i++) {
+        if (pthread_rwlock_init(&brl->slots[i].rwl, NULL) != 0) {
+            fprintf(stderr, "Error: rwlock create error\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    brl->writing = 0;
+}
+
+/**
+ * Destroys a big-reader lock.
+ * @param brl: big-reader lock
+*/
+void brlock_destroy(brlock *brl) {
+    for (int i = 0; i < BRLOCK_SLOTS; i++) {
+        if (pthread_rwlock_destroy(&brl->slots[i].rwl) != 0) {
+            fprintf(stderr, "Error: rwlock destroy error\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/**
+ * Returns the slot of the calling thread, threads get consecutive slots the
+ * first time they use a big-reader lock.
+ * @return slot index
+*/
+int brlock_thread_slot() {
+    if (brlock_thread_index == -1)
+        brlock_thread_index = __atomic_fetch_add(&brlock_next_slot, 1, __ATOMIC_RELAXED) % BRLOCK_SLOTS;
+    return brlock_thread_index;
+}
+
+/**
+ * Locks a big-reader lock for reading, only touching the slot of the thread.
+ * @param brl: big-reader lock
+*/
+void brlock_rdlock(brlock *brl) {
+    if (pthread_rwlock_rdlock(&brl->slots[brlock_thread_slot()].rwl) != 0) {
+        fprintf(stderr, "Error: lock rdlock error\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Tries to lock a big-reader lock for reading.
+ * @param brl: big-reader lock
+ * @return 0 if locked, otherwise an error number
+*/
+int brlock_tryrdlock(brlock *brl) {
+    return pthread_rwlock_tryrdlock(&brl->slots[brlock_thread_slot()].rwl);
+}
+
+/**
+ * Locks a big-reader lock for writing, locking every slot in order.
+ * @param brl: big-reader lock
+*/
+void brlock_wrlock(brlock *brl) {
+    for (int i = 0; i < BRLOCK_SLOTS; i++) {
+        if (pthread_rwlock_wrlock(&brl->slots[i].rwl) != 0) {
+            fprintf(stderr, "Error: lock wrlock error\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    brl->writer = pthread_self();
+    __atomic_store_n(&brl->writing, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Tries to lock a big-reader lock for writing.
+ * @param brl: big-reader lock
+ * @return 0 if locked, otherwise an error number
+*/
+int brlock_trywrlock(brlock *brl) {
+    int error;
+
+    for (int i = 0; i < BRLOCK_SLOTS; i++) {
+        if ((error = pthread_rwlock_trywrlock(&brl->slots[i].rwl)) != 0) {
+            /* releases the slots already locked */
+            for (i--; i >= 0; i--)
+                pthread_rwlock_unlock(&brl->slots[i].rwl);
+            return error;
+        }
+    }
+    brl->writer = pthread_self();
+    __atomic_store_n(&brl->writing, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/**
+ * Unlocks a big-reader lock, held either for reading or writing.
+ * @param brl: big-reader lock
+*/
+void brlock_unlock(brlock *brl) {
+    /* a reader holds its slot, so no other thread can be writing */
+    if (__atomic_load_n(&brl->writing, __ATOMIC_RELAXED) && pthread_equal(brl->writer, pthread_self())) {
+        __atomic_store_n(&brl->writing, 0, __ATOMIC_RELAXED);
+        for (int i = BRLOCK_SLOTS - 1; i >= 0; i--) {
+            if (pthread_rwlock_unlock(&brl->slots[i].rwl) != 0) {
+                fprintf(stderr, "Error: rwlock unlock error\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        return;
+    }
+
+    if (pthread_rwlock_unlock(&brl->slots[brlock_thread_slot()].rwl) != 0) {
+        fprintf(stderr, "Error: rwlock unlock error\n");
+        exit(EXIT_FAILURE);
+    }
+}
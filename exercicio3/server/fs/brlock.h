@@ -0,0 +1,34 @@
+#ifndef BRLOCK_H
+#define BRLOCK_H
+
+#include <pthread.h>
+
+#define BRLOCK_SLOTS 64
+#define CACHE_LINE_SIZE 64
+
+/*
+ * Reader indicator of a big-reader lock, each one in its own cache line
+ */
+typedef struct brlock_slot {
+	pthread_rwlock_t rwl;
+} __attribute__((aligned(CACHE_LINE_SIZE))) brlock_slot;
+
+/*
+ * Big-reader lock: readers only lock the slot of their thread, writers lock every slot
+ */
+typedef struct brlock {
+	brlock_slot slots[BRLOCK_SLOTS];
+	int writing;        /* set while a writer holds every slot */
+	pthread_t writer;
+} brlock;
+
+void brlock_init(brlock *brl);
+void brlock_destroy(brlock *brl);
+int brlock_thread_slot();
+void brlock_rdlock(brlock *brl);
+int brlock_tryrdlock(brlock *brl);
+void brlock_wrlock(brlock *brl);
+int brlock_trywrlock(brlock *brl);
+void brlock_unlock(brlock *brl);
+
+#endif /* BRLOCK_H */
@@ -0,0 +1,401 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include "ebr.h"
+
+long ebr_global_epoch = 0;
+ebr_thread ebr_threads[EBR_MAX_THREADS];
+int ebr_num_threads = 0;                /* records handed out at least once, the ones scanned */
+int ebr_overflow_active = 0;            /* threads without a record inside a request */
+ebr_retired *ebr_orphans = NULL;        /* objects retired by threads that no longer have a record */
+pthread_mutex_t ebr_orphans_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_key_t ebr_key;                  /* gives the record back when its thread exits */
+pthread_once_t ebr_key_once = PTHREAD_ONCE_INIT;
+__thread ebr_thread *ebr_record = NULL;
+__thread int ebr_overflow_depth = 0;    /* nesting depth of ebr_enter of a thread without a record */
+
+static void ebr_release_record(void *ptr);
+
+static void ebr_create_key() {
+    if (pthread_key_create(&ebr_key, ebr_release_record) != 0) {
+        fprintf(stderr, "Error: ebr key create error\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void ebr_limbo_lock(ebr_thread *record) {
+    while (__atomic_exchange_n(&record->limbo_busy, 1, __ATOMIC_ACQUIRE))
+        sched_yield();
+}
+
+static int ebr_limbo_trylock(ebr_thread *record) {
+    return !__atomic_exchange_n(&record->limbo_busy, 1, __ATOMIC_ACQUIRE);
+}
+
+static void ebr_limbo_unlock(ebr_thread *record) {
+    __atomic_store_n(&record->limbo_busy, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Releases a list of retired objects.
+ * @param retired: first object of the list
+*/
+static void ebr_release_list(ebr_retired *retired) {
+    while (retired != NULL) {
+        ebr_retired *next = retired->next;
+        retired->release(retired->ptr);
+        free(retired);
+        retired = next;
+    }
+}
+
+/**
+ * Takes a free record for the calling thread. The record is given back by
+ * ebr_unregister, or when the thread exits.
+ * @return record, or NULL if every record is taken
+*/
+static ebr_thread *ebr_register() {
+    pthread_once(&ebr_key_once, ebr_create_key);
+
+    for (int i = 0; i < EBR_MAX_THREADS; i++) {
+        ebr_thread *record = &ebr_threads[i];
+        int num_threads;
+
+        if (__atomic_load_n(&record->in_use, __ATOMIC_RELAXED) ||
+                __atomic_exchange_n(&record->in_use, 1, __ATOMIC_ACQUIRE))
+            continue;
+
+        /* the record is scanned by ebr_try_advance before the thread becomes active */
+        num_threads = __atomic_load_n(&ebr_num_threads, __ATOMIC_SEQ_CST);
+        while (num_threads <= i && !__atomic_compare_exchange_n(&ebr_num_threads, &num_threads, i + 1, 0,
+                                                                  __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+            ;
+        record->depth = 0;
+        pthread_setspecific(ebr_key, record);
+        return record;
+    }
+    return NULL;
+}
+
+/**
+ * Returns the record of the calling thread, registering it the first time.
+ * A thread that finds every record taken runs without one (see ebr_enter).
+ * @return epoch record of the thread, or NULL
+*/
+ebr_thread *ebr_self() {
+    if (ebr_record == NULL && ebr_overflow_depth == 0)
+        ebr_record = ebr_register();
+    return ebr_record;
+}
+
+/**
+ * Gives a record back: its limbo lists go to the orphans, released by the
+ * threads that collect, and the record may be taken by another thread.
+ * @param ptr: record
+*/
+static void ebr_release_record(void *ptr) {
+    ebr_thread *record = (ebr_thread*) ptr;
+
+    __atomic_store_n(&record->active, 0, __ATOMIC_RELEASE);
+    record->depth = 0;
+
+    ebr_limbo_lock(record);
+    pthread_mutex_lock(&ebr_orphans_lock);
+    for (int i = 0; i < EBR_EPOCHS; i++) {
+        ebr_retired *retired = record->limbo[i];
+
+        while (retired != NULL) {
+            ebr_retired *next = retired->next;
+            retired->next = ebr_orphans;
+            ebr_orphans = retired;
+            retired = next;
+        }
+        record->limbo[i] = NULL;
+    }
+    pthread_mutex_unlock(&ebr_orphans_lock);
+    ebr_limbo_unlock(record);
+
+    if (ebr_record == record) {
+        ebr_record = NULL;
+        pthread_setspecific(ebr_key, NULL);
+    }
+    __atomic_store_n(&record->in_use, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Gives the record of the calling thread back, so that a long lived program
+ * may start any number of threads. Called outside of a request, done
+ * automatically when a thread that has a record exits.
+*/
+void ebr_unregister() {
+    if (ebr_record != NULL)
+        ebr_release_record(ebr_record);
+}
+
+/**
+ * Announces that the thread started a request, objects retired from now on
+ * are not released while it is active. Calls can be nested.
+ * A thread without a record holds the global epoch back while it is active.
+*/
+void ebr_enter() {
+    ebr_thread *self = ebr_self();
+
+    if (self == NULL) {
+        if (ebr_overflow_depth++ == 0)
+            __atomic_add_fetch(&ebr_overflow_active, 1, __ATOMIC_SEQ_CST);
+        return;
+    }
+    if (self->depth++ > 0)
+        return;
+    __atomic_store_n(&self->active, 1, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&self->epoch, __atomic_load_n(&ebr_global_epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Announces that the thread finished a request and, if it retired objects,
+ * releases the ones no reader can still see.
+*/
+void ebr_exit() {
+    ebr_thread *self = ebr_record;
+
+    if (self == NULL) {
+        if (--ebr_overflow_depth > 0)
+            return;
+        __atomic_sub_fetch(&ebr_overflow_active, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&ebr_orphans, __ATOMIC_RELAXED) != NULL)
+            ebr_collect();
+        return;
+    }
+    if (--self->depth > 0)
+        return;
+    __atomic_store_n(&self->active, 0, __ATOMIC_RELEASE);
+
+    /* a collector may have taken the lists meanwhile */
+    for (int i = 0; i < EBR_EPOCHS; i++) {
+        if (__atomic_load_n(&self->limbo[i], __ATOMIC_RELAXED) != NULL) {
+            ebr_collect();
+            break;
+        }
+    }
+}
+
+/**
+ * Stops announcing an epoch while the thread blocks without holding references
+ * to shared objects, so it doesn't hold back reclamation while it waits.
+*/
+void ebr_park() {
+    ebr_thread *self = ebr_record;
+
+    if (self == NULL) {
+        if (ebr_overflow_depth > 0)
+            __atomic_sub_fetch(&ebr_overflow_active, 1, __ATOMIC_SEQ_CST);
+    }
+    else if (self->depth > 0)
+        __atomic_store_n(&self->active, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Announces the current epoch again after ebr_park.
+*/
+void ebr_unpark() {
+    ebr_thread *self = ebr_record;
+
+    if (self == NULL) {
+        if (ebr_overflow_depth > 0)
+            __atomic_add_fetch(&ebr_overflow_active, 1, __ATOMIC_SEQ_CST);
+    }
+    else if (self->depth > 0) {
+        __atomic_store_n(&self->active, 1, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&self->epoch, __atomic_load_n(&ebr_global_epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+    }
+}
+
+/**
+ * Announces the current epoch without leaving the request, for threads that
+ * run for long (ex: a combiner) at points where they hold no references.
+*/
+void ebr_quiescent() {
+    ebr_thread *self = ebr_record;
+
+    if (self != NULL && self->depth > 0)
+        __atomic_store_n(&self->epoch, __atomic_load_n(&ebr_global_epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Advances the global epoch if every active thread has seen the current one.
+ * @return 1 if the epoch advanced, 0 otherwise
+*/
+int ebr_try_advance() {
+    long epoch = __atomic_load_n(&ebr_global_epoch, __ATOMIC_SEQ_CST);
+    int num_threads = __atomic_load_n(&ebr_num_threads, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&ebr_overflow_active, __ATOMIC_SEQ_CST) > 0)
+        return 0;
+
+    for (int i = 0; i < num_threads; i++) {
+        if (__atomic_load_n(&ebr_threads[i].active, __ATOMIC_SEQ_CST) &&
+                __atomic_load_n(&ebr_threads[i].epoch, __ATOMIC_SEQ_CST) != epoch)
+            return 0;
+    }
+    return __atomic_compare_exchange_n(&ebr_global_epoch, &epoch, epoch + 1, 0,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Takes the limbo lists of a record that are at least two epochs old, the
+ * caller must hold the limbo lists of the record.
+ * @param record: epoch record of a thread
+ * @param epoch: current global epoch
+ * @param expired: where the lists taken are stored, EBR_EPOCHS at most
+ * @return number of lists taken
+*/
+static int ebr_take_limbo(ebr_thread *record, long epoch, ebr_retired **expired) {
+    int count = 0;
+
+    for (int i = 0; i < EBR_EPOCHS; i++) {
+        if (record->limbo[i] != NULL && record->limbo_epoch[i] + 2 <= epoch) {
+            expired[count++] = record->limbo[i];
+            __atomic_store_n(&record->limbo[i], NULL, __ATOMIC_RELAXED);
+        }
+    }
+    return count;
+}
+
+/**
+ * Releases the limbo lists of a thread that are at least two epochs old.
+ * @param self: epoch record of the thread
+ * @param epoch: current global epoch
+*/
+void ebr_release_limbo(ebr_thread *self, long epoch) {
+    ebr_retired *expired[EBR_EPOCHS];
+    int count;
+
+    ebr_limbo_lock(self);
+    count = ebr_take_limbo(self, epoch, expired);
+    ebr_limbo_unlock(self);
+
+    /* released without the lists, a release may take locks of the fs */
+    for (int i = 0; i < count; i++)
+        ebr_release_list(expired[i]);
+}
+
+/**
+ * Releases the orphans that are at least two epochs old.
+ * @param epoch: current global epoch
+*/
+static void ebr_release_orphans(long epoch) {
+    ebr_retired *expired = NULL, **link;
+
+    if (__atomic_load_n(&ebr_orphans, __ATOMIC_RELAXED) == NULL)
+        return;
+
+    pthread_mutex_lock(&ebr_orphans_lock);
+    link = &ebr_orphans;
+    while (*link != NULL) {
+        ebr_retired *retired = *link;
+
+        if (retired->epoch + 2 <= epoch) {
+            *link = retired->next;
+            retired->next = expired;
+            expired = retired;
+        }
+        else
+            link = &retired->next;
+    }
+    pthread_mutex_unlock(&ebr_orphans_lock);
+
+    ebr_release_list(expired);
+}
+
+/**
+ * Tries to advance the global epoch and releases the objects no reader can
+ * still see: the ones retired by the calling thread, by the threads that are
+ * not collecting at the same time (ex: idle ones) and by the threads gone.
+ * If no other thread is active the epoch advances twice, so the objects are
+ * released right away.
+*/
+void ebr_collect() {
+    int num_threads = __atomic_load_n(&ebr_num_threads, __ATOMIC_SEQ_CST);
+    long epoch;
+
+    if (ebr_try_advance())
+        ebr_try_advance();
+    epoch = __atomic_load_n(&ebr_global_epoch, __ATOMIC_SEQ_CST);
+
+    for (int i = 0; i < num_threads; i++) {
+        ebr_thread *record = &ebr_threads[i];
+        ebr_retired *expired[EBR_EPOCHS];
+        int count;
+
+        if (record == ebr_record) {
+            ebr_release_limbo(record, epoch);
+            continue;
+        }
+        /* the limbo lists of a thread busy with them are left to it */
+        if (!ebr_limbo_trylock(record))
+            continue;
+        count = ebr_take_limbo(record, epoch, expired);
+        ebr_limbo_unlock(record);
+        for (int j = 0; j < count; j++)
+            ebr_release_list(expired[j]);
+    }
+    ebr_release_orphans(epoch);
+}
+
+/**
+ * Retires an object, it is released once every thread active now has finished.
+ * Must be called between ebr_enter and ebr_exit.
+ * @param release: function that releases the object
+ * @param ptr: object
+*/
+void ebr_retire(void (*release)(void *ptr), void *ptr) {
+    ebr_thread *self = ebr_record;
+    long epoch = __atomic_load_n(&ebr_global_epoch, __ATOMIC_SEQ_CST);
+    int i = epoch % EBR_EPOCHS, count = 0;
+    ebr_retired *expired[EBR_EPOCHS];
+
+    ebr_retired *retired = (ebr_retired*) malloc(sizeof(ebr_retired));
+    if (retired == NULL) {
+        fprintf(stderr, "Error: ebr malloc error\n");
+        exit(EXIT_FAILURE);
+    }
+    retired->release = release;
+    retired->ptr = ptr;
+    retired->epoch = epoch;
+
+    /* a thread without a record has no limbo lists */
+    if (self == NULL) {
+        pthread_mutex_lock(&ebr_orphans_lock);
+        retired->next = ebr_orphans;
+        ebr_orphans = retired;
+        pthread_mutex_unlock(&ebr_orphans_lock);
+        return;
+    }
+
+    ebr_limbo_lock(self);
+    /* the list still has objects of an old epoch, which are safe to release by now */
+    if (self->limbo[i] != NULL && self->limbo_epoch[i] != epoch)
+        count = ebr_take_limbo(self, epoch, expired);
+
+    retired->next = self->limbo[i];
+    self->limbo[i] = retired;
+    self->limbo_epoch[i] = epoch;
+    ebr_limbo_unlock(self);
+
+    for (int j = 0; j < count; j++)
+        ebr_release_list(expired[j]);
+}
+
+/**
+ * Releases every retired object of every thread.
+ * Only safe when no other thread is running (ex: when the fs is destroyed).
+*/
+void ebr_flush() {
+    int num_threads = __atomic_load_n(&ebr_num_threads, __ATOMIC_SEQ_CST);
+    long epoch = __atomic_load_n(&ebr_global_epoch, __ATOMIC_SEQ_CST) + 2 + EBR_EPOCHS;
+
+    for (int i = 0; i < num_threads; i++)
+        ebr_release_limbo(&ebr_threads[i], epoch);
+    ebr_release_orphans(epoch);
+}
@@ -0,0 +1,46 @@
+#ifndef EBR_H
+#define EBR_H
+
+#include "brlock.h"
+
+#define EBR_MAX_THREADS 256
+/* objects retired in epoch E can be released once the global epoch is E+2 */
+#define EBR_EPOCHS 3
+
+/*
+ * Object waiting for every reader that may see it to leave
+ */
+typedef struct ebr_retired {
+	void (*release)(void *ptr);
+	void *ptr;
+	long epoch;                         /* global epoch when it was retired */
+	struct ebr_retired *next;
+} ebr_retired;
+
+/*
+ * Epoch announced by a thread and its limbo lists, each thread in its own cache line
+ */
+typedef struct ebr_thread {
+	int in_use;                         /* set while a thread owns the record */
+	int active;                         /* set while the thread may hold references */
+	int depth;                          /* nesting depth of ebr_enter, only used by the thread */
+	long epoch;                         /* global epoch seen when it became active */
+	int limbo_busy;                     /* set while the owner or a collector uses the limbo lists */
+	ebr_retired *limbo[EBR_EPOCHS];     /* retired objects, by epoch */
+	long limbo_epoch[EBR_EPOCHS];
+} __attribute__((aligned(CACHE_LINE_SIZE))) ebr_thread;
+
+ebr_thread *ebr_self();
+void ebr_unregister();
+void ebr_enter();
+void ebr_exit();
+void ebr_park();
+void ebr_unpark();
+void ebr_quiescent();
+int ebr_try_advance();
+void ebr_release_limbo(ebr_thread *self, long epoch);
+void ebr_collect();
+void ebr_retire(void (*release)(void *ptr), void *ptr);
+void ebr_flush();
+
+#endif /* EBR_H */
@@ -4,6 +4,11 @@
 #include <string.h>
 #include <pthread.h>
 
+int big_reader_dirs = 0; /* if set, top-level directories also use big-reader locks */
+int combining_dirs = 0; /* if set, creates and deletes are combined per directory */
+
+combine_queue combine_queues[INODE_TABLE_SIZE];
+
 /**
  * Given a path, fills pointers with strings for the parent path and child file name.
  * @param path: the path to split. ATENTION: the function may alter this parameter
@@ -49,15 +54,32 @@ void init_fs() {
 	int root = inode_create(T_DIRECTORY);
 	
 	if (root != FS_ROOT) {
-		printf("failed to create node for tecnicofs root\n");
+		FS_LOG("failed to create node for tecnicofs root\n");
 		exit(EXIT_FAILURE);
 	}
+
+	/* every operation rdlocks the root */
+	inode_set_big_reader(FS_ROOT, 1);
+
+	for (int i = 0; i < INODE_TABLE_SIZE; i++) {
+		if (pthread_mutex_init(&combine_queues[i].mutex, NULL) != 0 ||
+				pthread_cond_init(&combine_queues[i].cond, NULL) != 0) {
+			fprintf(stderr, "Error: combine queue create error\n");
+			exit(EXIT_FAILURE);
+		}
+		combine_queues[i].pending = NULL;
+		combine_queues[i].combining = 0;
+	}
 }
 
 /**
  * Destroy tecnicofs and inode table.
 */
 void destroy_fs() {
+	for (int i = 0; i < INODE_TABLE_SIZE; i++) {
+		pthread_mutex_destroy(&combine_queues[i].mutex);
+		pthread_cond_destroy(&combine_queues[i].cond);
+	}
 	inode_table_destroy();
 }
 
@@ -104,62 +126,88 @@ int lookup_sub_node(char *name, DirEntry *entries) {
 */
 int create(char *name, type nodeType){
 
+	int size, result;
+	int locked_inodes[INODE_TABLE_SIZE];
+
+	/* a failed create releases its inode, which must wait for readers */
+	ebr_enter();
+	/* inode_create fails at once while holding the parent, waits for free slots before */
+	inode_reclaim();
+	if (combining_dirs)
+		result = combine(name, 'c', nodeType);
+	else {
+		size = lockPath(name,locked_inodes,"w");
+		result = apply_create(name, nodeType, NULL);
+		unlock(locked_inodes,size);
+	}
+	ebr_exit();
+
+	return result;
+}
+
+/**
+ * Creates a new node given a path, the caller must already hold the locks of the path.
+ * @param name: path of node
+ * @param nodeType: type of node
+ * @param record: if not NULL, stores what is needed to undo the creation
+ * @return SUCESS or FAIL
+*/
+int apply_create(char *name, type nodeType, tx_record *record){
+
 	int parent_inumber, child_inumber;
 	char *parent_name, *child_name, name_copy[MAX_FILE_NAME];
 	/* use for copy */
 	type pType;
 	union Data pdata;
 
-	int size;
-	int locked_inodes[INODE_TABLE_SIZE];
-
-	size = lockPath(name,locked_inodes,"w");
-
 	strcpy(name_copy, name);
 	split_parent_child_from_path(name_copy, &parent_name, &child_name);
 
 	parent_inumber = lookup(parent_name,'l');
 
 	if (parent_inumber == FAIL) {
-		printf("failed to create %s, invalid parent dir %s\n",
+		FS_LOG("failed to create %s, invalid parent dir %s\n",
 		        name, parent_name);
-		unlock(locked_inodes,size);
 		return FAIL;
 	}
 
 	inode_get(parent_inumber, &pType, &pdata);
 
 	if(pType != T_DIRECTORY) {
-		printf("failed to create %s, parent %s is not a dir\n",
+		FS_LOG("failed to create %s, parent %s is not a dir\n",
 		        name, parent_name);
-		unlock(locked_inodes,size);
 		return FAIL;
 	}
 
 	if (lookup_sub_node(child_name, pdata.dirEntries) != FAIL) {
-		printf("failed to create %s, already exists in dir %s\n",
+		FS_LOG("failed to create %s, already exists in dir %s\n",
 		       child_name, parent_name);
-		unlock(locked_inodes,size);
 		return FAIL;
 	}
 
 	/* create node and add entry to folder that contains new node */
 	child_inumber = inode_create(nodeType);
 	if (child_inumber == FAIL) {
-		printf("failed to create %s in  %s, couldn't allocate inode\n",
+		FS_LOG("failed to create %s in  %s, couldn't allocate inode\n",
 		        child_name, parent_name);
-		unlock(locked_inodes,size);
 		return FAIL;
 	}
 
+	if (big_reader_dirs && parent_inumber == FS_ROOT && nodeType == T_DIRECTORY)
+		inode_set_big_reader(child_inumber, 1);
+
 	if (dir_add_entry(parent_inumber, child_inumber, child_name) == FAIL) {
-		printf("could not add entry %s in dir %s\n",
+		FS_LOG("could not add entry %s in dir %s\n",
 		       child_name, parent_name);
-		unlock(locked_inodes,size);
+		inode_delete(child_inumber);
 		return FAIL;
 	}
 
-	unlock(locked_inodes,size);
+	if (record != NULL) {
+		record->token = 'c';
+		record->parent_inumber = parent_inumber;
+		record->child_inumber = child_inumber;
+	}
 	return SUCCESS;
 }
 
@@ -170,86 +218,258 @@ int create(char *name, type nodeType){
 */
 int delete(char *name){
 
+	int size, result;
+	int locked_inodes[INODE_TABLE_SIZE];
+
+	/* the deleted inode is only released after ebr_exit, so its lock is still valid */
+	ebr_enter();
+	if (combining_dirs)
+		result = combine(name, 'd', T_NONE);
+	else {
+		size = lockPath(name,locked_inodes,"w");
+		result = apply_delete(name, NULL);
+		unlock(locked_inodes,size);
+	}
+	ebr_exit();
+
+	return result;
+}
+
+/**
+ * Deletes a node given a path, the caller must already hold the locks of the path.
+ * @param name: path of node
+ * @param record: if not NULL, the inode is only removed from its parent and
+ * 	the caller is responsible for releasing it (or restoring the entry)
+ * @return SUCCESS OR FAIL
+*/
+int apply_delete(char *name, tx_record *record){
+
 	int parent_inumber, child_inumber;
 	char *parent_name, *child_name, name_copy[MAX_FILE_NAME];
 	/* use for copy */
 	type pType, cType;
 	union Data pdata, cdata;
 
-	int size;
-	int locked_inodes[INODE_TABLE_SIZE];
-	pthread_rwlock_t* lock;
-
-	size = lockPath(name,locked_inodes,"w");
-
 	strcpy(name_copy, name);
 	split_parent_child_from_path(name_copy, &parent_name, &child_name);
 
 	parent_inumber = lookup(parent_name,'l');
 
 	if (parent_inumber == FAIL) {
-		printf("failed to delete %s, invalid parent dir %s\n",
+		FS_LOG("failed to delete %s, invalid parent dir %s\n",
 		        child_name, parent_name);
-		unlock(locked_inodes,size);
 		return FAIL;
 	}
 
 	inode_get(parent_inumber, &pType, &pdata);
 
 	if(pType != T_DIRECTORY) {
-		printf("failed to delete %s, parent %s is not a dir\n",
+		FS_LOG("failed to delete %s, parent %s is not a dir\n",
 		        child_name, parent_name);
-		unlock(locked_inodes,size);
 		return FAIL;
 	}
 
 	child_inumber = lookup_sub_node(child_name, pdata.dirEntries);
 
 	if (child_inumber == FAIL) {
-		printf("could not delete %s, does not exist in dir %s\n",
+		FS_LOG("could not delete %s, does not exist in dir %s\n",
 		       name, parent_name);
-		unlock(locked_inodes,size);
 		return FAIL;
 	}
 
 	inode_get(child_inumber, &cType, &cdata);
 
-	if((lock = getlock(child_inumber)) == NULL){
-		return FAIL;
-	}
-
 	if (cType == T_DIRECTORY && is_dir_empty(cdata.dirEntries) == FAIL) {
-		printf("could not delete %s: is a directory and not empty\n",
+		FS_LOG("could not delete %s: is a directory and not empty\n",
 		       name);
-		unlock(locked_inodes,size);
 		return FAIL;
 	}
 
 	/* remove entry from folder that contained deleted node */
 	if (dir_reset_entry(parent_inumber, child_inumber) == FAIL) {
-		printf("failed to delete %s from dir %s\n",
+		FS_LOG("failed to delete %s from dir %s\n",
 		       child_name, parent_name);
-		unlock(locked_inodes,size);
 		return FAIL;
 	}
 
+	if (record != NULL) {
+		record->token = 'd';
+		record->parent_inumber = parent_inumber;
+		record->child_inumber = child_inumber;
+		strcpy(record->child_name, child_name);
+		return SUCCESS;
+	}
+
 	if (inode_delete(child_inumber) == FAIL) {  
-		printf("could not delete inode number %d from dir %s\n",
+		FS_LOG("could not delete inode number %d from dir %s\n",
 		       child_inumber, parent_name);
-		unlock(locked_inodes,size);
 		return FAIL;
 	}
 
-	/* unlocks deleted inode */
-	if(pthread_rwlock_unlock(lock) != 0){
-        fprintf(stderr, "Error: rwlock unlock error\n");
-        exit(EXIT_FAILURE);
-    }
+	return SUCCESS;
+}
 
-	unlock(locked_inodes,size-1);  //size-1 because deleted inode was already unlocked
+/**
+ * Applies a combined create or delete, the combiner holds the wrlock of the parent.
+ * Nobody else can be inside a child of the parent (they would rdlock the parent),
+ * so the child doesn't need to be locked.
+ * @param parent_inumber: identifier of the parent directory
+ * @param request: create or delete request
+ * @return SUCCESS or FAIL
+*/
+int apply_combine_request(int parent_inumber, combine_request *request){
+
+	int child_inumber;
+	type pType, cType;
+	union Data pdata, cdata;
+
+	inode_get(parent_inumber, &pType, &pdata);
+	child_inumber = lookup_sub_node(request->child_name, pdata.dirEntries);
+
+	if (request->token == 'c') {
+		if (child_inumber != FAIL) {
+			FS_LOG("failed to create %s, already exists\n", request->child_name);
+			return FAIL;
+		}
+		if ((child_inumber = inode_create(request->nodeType)) == FAIL) {
+			FS_LOG("failed to create %s, couldn't allocate inode\n", request->child_name);
+			return FAIL;
+		}
+		if (big_reader_dirs && parent_inumber == FS_ROOT && request->nodeType == T_DIRECTORY)
+			inode_set_big_reader(child_inumber, 1);
+		if (dir_add_entry(parent_inumber, child_inumber, request->child_name) == FAIL) {
+			FS_LOG("could not add entry %s\n", request->child_name);
+			inode_delete(child_inumber);
+			return FAIL;
+		}
+		return SUCCESS;
+	}
+
+	if (child_inumber == FAIL) {
+		FS_LOG("could not delete %s, does not exist\n", request->child_name);
+		return FAIL;
+	}
+	inode_get(child_inumber, &cType, &cdata);
+	if (cType == T_DIRECTORY && is_dir_empty(cdata.dirEntries) == FAIL) {
+		FS_LOG("could not delete %s: is a directory and not empty\n", request->child_name);
+		return FAIL;
+	}
+	if (dir_reset_entry(parent_inumber, child_inumber) == FAIL ||
+			inode_delete(child_inumber) == FAIL) {
+		FS_LOG("failed to delete %s\n", request->child_name);
+		return FAIL;
+	}
 	return SUCCESS;
 }
 
+/**
+ * Creates or deletes a node by publishing the request in the queue of its parent.
+ * Only the ancestors of the parent are rdlocked (so the parent can't be moved or
+ * deleted). The first thread to find no combiner becomes one: it wrlocks the
+ * parent once and applies every pending request of that directory, instead of
+ * each thread waiting for its own turn with the wrlock.
+ * @param name: path of node
+ * @param token: 'c' to create, 'd' to delete
+ * @param nodeType: type of node (create only)
+ * @return SUCCESS or FAIL
+*/
+int combine(char *name, char token, type nodeType){
+
+	int parent_inumber, size = 0;
+	char *parent_name, *child_name, name_copy[MAX_FILE_NAME];
+	char *grandparent_name, *parent_child_name, parent_copy[MAX_FILE_NAME];
+	int locked_inodes[INODE_TABLE_SIZE];
+	type pType;
+	combine_request request;
+
+	strcpy(name_copy, name);
+	split_parent_child_from_path(name_copy, &parent_name, &child_name);
+
+	/* the root has no ancestors to lock */
+	if (parent_name[0] != '\0') {
+		strcpy(parent_copy, parent_name);
+		split_parent_child_from_path(parent_copy, &grandparent_name, &parent_child_name);
+		size = lockPath(grandparent_name, locked_inodes, "r");
+	}
+
+	parent_inumber = lookup(parent_name, 'l');
+	if (parent_inumber == FAIL || inode_get(parent_inumber, &pType, NULL) == FAIL || pType != T_DIRECTORY) {
+		FS_LOG("failed to %s %s, invalid parent dir %s\n",
+		       token == 'c' ? "create" : "delete", name, parent_name);
+		unlock(locked_inodes, size);
+		return FAIL;
+	}
+
+	request.token = token;
+	strcpy(request.child_name, child_name);
+	request.nodeType = nodeType;
+	request.done = 0;
+
+	combine_queue *queue = &combine_queues[parent_inumber];
+
+	pthread_mutex_lock(&queue->mutex);
+	request.next = queue->pending;
+	queue->pending = &request;
+
+	/* only the request (in this stack) is used while waiting, so reclamation can go on */
+	ebr_park();
+	while (!request.done && queue->combining)
+		pthread_cond_wait(&queue->cond, &queue->mutex);
+	ebr_unpark();
+
+	if (!request.done) {
+		/* becomes the combiner, its own request is still pending */
+		queue->combining = 1;
+		pthread_mutex_unlock(&queue->mutex);
+
+		inode_lock(parent_inumber, "w");
+		for (int round = 0; round < COMBINE_MAX_ROUNDS; round++) {
+			combine_request *batch, *ordered = NULL;
+
+			pthread_mutex_lock(&queue->mutex);
+			batch = queue->pending;
+			queue->pending = NULL;
+			pthread_mutex_unlock(&queue->mutex);
+
+			if (batch == NULL)
+				break;
+
+			/* the queue is a stack, reverses it to apply requests by arrival order */
+			while (batch != NULL) {
+				combine_request *next = batch->next;
+				batch->next = ordered;
+				ordered = batch;
+				batch = next;
+			}
+			for (combine_request *r = ordered; r != NULL; r = r->next) {
+				r->result = apply_combine_request(parent_inumber, r);
+				/* requests are independent, the combiner holds no references between them */
+				ebr_quiescent();
+			}
+
+			pthread_mutex_lock(&queue->mutex);
+			while (ordered != NULL) {
+				combine_request *next = ordered->next;
+				/* the request lives in the stack of its thread, done must be the last access */
+				ordered->done = 1;
+				ordered = next;
+			}
+			pthread_cond_broadcast(&queue->cond);
+			pthread_mutex_unlock(&queue->mutex);
+		}
+		inode_unlock(parent_inumber);
+
+		pthread_mutex_lock(&queue->mutex);
+		queue->combining = 0;
+		/* wakes a waiting thread to become the next combiner */
+		pthread_cond_broadcast(&queue->cond);
+	}
+	pthread_mutex_unlock(&queue->mutex);
+
+	unlock(locked_inodes, size);
+	return request.result;
+}
+
 /**
  * Lookup for a given path.
  * @param name: path of node
@@ -341,19 +561,11 @@ int verifyLoop(char* path, char* dest){
 */
 int move(char* path, char* dest){
 
-	int parent_inumber, child_inumber, parent_inumber_dest;
-	char *parent_name, *child_name, *parent_name_dest, *child_name_dest;
-
-	char name_copy[MAX_FILE_NAME];
-
-	int size, size_dest, value;
+	int size, size_dest, value, result;
 	int locked_inodes[INODE_TABLE_SIZE], locked_inodes_dest[INODE_TABLE_SIZE];
 
-	type ptype, ptype_dest;
-	union Data pdata, pdata_dest;
-
 	if(verifyLoop(path,dest) == FAIL){
-		printf("failed to move, cannot move %s to a subdirectory of itself, %s\n", path, dest);
+		FS_LOG("failed to move, cannot move %s to a subdirectory of itself, %s\n", path, dest);
 		return FAIL;
 	}
 
@@ -383,33 +595,51 @@ int move(char* path, char* dest){
 			return SUCCESS;
 	}
 
+	result = apply_move(path, dest, NULL);
+
+	unlock(locked_inodes,size);
+	unlock(locked_inodes_dest,size_dest);
+	return result;
+}
+
+/**
+ * Moves file/dir from one path to another, the caller must already hold the locks of both paths.
+ * @param path: path of node
+ * @param dest: destiny path
+ * @param record: if not NULL, stores what is needed to undo the move
+ * @return SUCCESS or FAIL
+*/
+int apply_move(char* path, char* dest, tx_record *record){
+
+	int parent_inumber, child_inumber, parent_inumber_dest;
+	char *parent_name, *child_name, *parent_name_dest, *child_name_dest;
+
+	char name_copy[MAX_FILE_NAME];
+
+	type ptype, ptype_dest;
+	union Data pdata, pdata_dest;
+
 	strcpy(name_copy, path);
 	split_parent_child_from_path(name_copy, &parent_name, &child_name);
 
 	parent_inumber = lookup(parent_name,'l');
 
 	if (parent_inumber == FAIL) {
-		printf("failed to move %s, invalid parent dir %s\n",path, parent_name);
-		unlock(locked_inodes,size);
-		unlock(locked_inodes_dest,size_dest);
+		FS_LOG("failed to move %s, invalid parent dir %s\n",path, parent_name);
 		return FAIL;
 	}
 
 	inode_get(parent_inumber, &ptype, &pdata);
 	if(ptype != T_DIRECTORY) {
-		printf("failed to move %s, parent %s is not a dir\n",path, parent_name);
-		unlock(locked_inodes,size);
-		unlock(locked_inodes_dest,size_dest);
+		FS_LOG("failed to move %s, parent %s is not a dir\n",path, parent_name);
 		return FAIL;
 	}
 
 	child_inumber = lookup_sub_node(child_name, pdata.dirEntries);
 
 	if (child_inumber == FAIL) {
-		printf("failed to move %s, doesnt exists in dir %s\n",
+		FS_LOG("failed to move %s, doesnt exists in dir %s\n",
 		       child_name, parent_name);
-		unlock(locked_inodes,size);
-		unlock(locked_inodes_dest,size_dest);
 		return FAIL;
 	}
 
@@ -419,50 +649,46 @@ int move(char* path, char* dest){
 	parent_inumber_dest = lookup(parent_name_dest,'l');
 
 	if (parent_inumber_dest == FAIL) {
-		printf("failed to move %s, invalid parent dir %s\n",dest, parent_name_dest);
-		unlock(locked_inodes,size);
-		unlock(locked_inodes_dest,size_dest);
+		FS_LOG("failed to move %s, invalid parent dir %s\n",dest, parent_name_dest);
 		return FAIL;
 	}
 
 	inode_get(parent_inumber_dest, &ptype_dest, &pdata_dest);
 	if(ptype_dest != T_DIRECTORY) {
-		printf("failed to move %s, parent %s is not a dir\n",dest, parent_name_dest);
-		unlock(locked_inodes,size);
-		unlock(locked_inodes_dest,size_dest);
+		FS_LOG("failed to move %s, parent %s is not a dir\n",dest, parent_name_dest);
 		return FAIL;
 	}
 
 	if (lookup_sub_node(child_name_dest, pdata_dest.dirEntries) != FAIL) {
-		printf("failed to move %s, exists in dir %s\n",child_name_dest, parent_name_dest);
-		unlock(locked_inodes,size);
-		unlock(locked_inodes_dest,size_dest);
+		FS_LOG("failed to move %s, exists in dir %s\n",child_name_dest, parent_name_dest);
 		return FAIL;
 	}
 
 	if(child_inumber == parent_inumber_dest){
-		printf("failed to move %s, to a subdirectory of itself %s",child_name,parent_name_dest);
+		FS_LOG("failed to move %s, to a subdirectory of itself %s",child_name,parent_name_dest);
 		return FAIL;
 	}
 
 	/* resets entry in path directory */
 	if (dir_reset_entry(parent_inumber, child_inumber) == FAIL) {
-		printf("failed to delete %s from dir %s\n",child_name, parent_name);
-		unlock(locked_inodes,size);
-		unlock(locked_inodes_dest,size_dest);
+		FS_LOG("failed to delete %s from dir %s\n",child_name, parent_name);
 		return FAIL;
 	}
 
 	/* the new entry has the same inumber but a different name */
 	if (dir_add_entry(parent_inumber_dest, child_inumber, child_name_dest) == FAIL) {
-		printf("could not add entry %s in dir %s\n",child_name_dest, parent_name_dest);
-		unlock(locked_inodes,size);
-		unlock(locked_inodes_dest,size_dest);
+		FS_LOG("could not add entry %s in dir %s\n",child_name_dest, parent_name_dest);
+		dir_add_entry(parent_inumber, child_inumber, child_name);
 		return FAIL;
 	}
 
-	unlock(locked_inodes,size);
-	unlock(locked_inodes_dest,size_dest);
+	if (record != NULL) {
+		record->token = 'm';
+		record->parent_inumber = parent_inumber;
+		record->child_inumber = child_inumber;
+		record->parent_inumber_dest = parent_inumber_dest;
+		strcpy(record->child_name, child_name);
+	}
 	return SUCCESS;
 }
 
@@ -611,23 +837,286 @@ void unlock(int* array, int counter){
 	}
 }
 
+/**
+ * Lists a page of the entries of a directory, holding only rdlocks, so that
+ * writers of the directory wait for a page at most. The cursor is the slot
+ * of the entries array where the listing resumes: an entry added or removed
+ * between two pages may or may not be listed, the others are listed once.
+ * @param name: path of the directory
+ * @param cursor: 0 to start, or the cursor returned by the previous page
+ * @param entries: where the entries are stored
+ * @param max: entries listed at most
+ * @param next: where the cursor of the next page is stored, 0 if the
+ * 	listing is complete
+ * @return number of entries listed or FAIL
+*/
+int read_dir(char *name, int cursor, dir_listing *entries, int max, int *next){
+
+	int size, inumber, count = 0, slot;
+	int locked_inodes[INODE_TABLE_SIZE];
+	type nType;
+	union Data data;
+
+	if (cursor < 0 || cursor > MAX_DIR_ENTRIES || max <= 0)
+		return FAIL;
+
+	size = lockPath(name, locked_inodes, "r");
+	inumber = lookup(name, 'l');
+
+	if (inumber == FAIL || inode_get(inumber, &nType, &data) == FAIL || nType != T_DIRECTORY) {
+		FS_LOG("failed to list %s, not a directory\n", name);
+		unlock(locked_inodes, size);
+		return FAIL;
+	}
+
+	for (slot = cursor; slot < MAX_DIR_ENTRIES && count < max; slot++) {
+		DirEntry *entry = &data.dirEntries[slot];
+
+		if (entry->inumber == FREE_INODE)
+			continue;
+		/* the entry can't be removed while the directory is rdlocked */
+		strcpy(entries[count].name, entry->name);
+		entries[count].inumber = entry->inumber;
+		inode_get(entry->inumber, &entries[count].nodeType, NULL);
+		entries[count].next = slot + 1;
+		count++;
+	}
+	*next = slot < MAX_DIR_ENTRIES ? slot : 0;
+
+	unlock(locked_inodes, size);
+	return count;
+}
+
+/**
+ * Looks up a path and reads the attributes of its node, holding only rdlocks.
+ * @param name: path of node
+ * @param st: where the attributes are stored
+ * @return inumber or FAIL
+*/
+int stat_node(char *name, node_stat *st){
+
+	int size, inumber;
+	int locked_inodes[INODE_TABLE_SIZE];
+
+	size = lockPath(name, locked_inodes, "r");
+	inumber = lookup(name, 'l');
+	if (inumber != FAIL && inode_stat(inumber, st) == FAIL)
+		inumber = FAIL;
+	unlock(locked_inodes, size);
+
+	return inumber;
+}
+
 /**
  * Prints tecnicofs tree.
- * @param fp: pointer to file
+ * The root is only wrlocked while a snapshot is pinned, the tree is then
+ * printed from the snapshot while other operations keep running.
+ * @param file: path of the output file
 */
 int print_tecnicofs_tree(char *file){
 
-	inode_lock(FS_ROOT,"w");
-
+	long epoch;
 	FILE* fp;
 
+	/* waits for the operations in progress, so the snapshot is consistent */
+	inode_lock(FS_ROOT,"w");
+	epoch = snapshot_pin();
+	inode_unlock(FS_ROOT);
+
 	fp = fopen(file,"w");
-	if (fp == NULL)
+	if (fp == NULL) {
+		snapshot_unpin(epoch);
 		return FAIL;
+	}
 
-	inode_print_tree(fp, FS_ROOT, "");
+	inode_print_tree(fp, FS_ROOT, "", epoch);
 	fclose(fp);
-	
-	inode_unlock(FS_ROOT);
+
+	snapshot_unpin(epoch);
 	return SUCCESS;
 }
+
+/**
+ * Compares two lock requests of a transaction, shallower nodes come first and
+ * nodes with the same depth are ordered alphabetically by path.
+*/
+int compare_tx_locks(const void *a, const void *b){
+	const tx_lock *la = (const tx_lock*) a, *lb = (const tx_lock*) b;
+
+	if (la->depth != lb->depth)
+		return la->depth - lb->depth;
+	return strcmp(la->path, lb->path);
+}
+
+/**
+ * Adds every node of a path to the set of locks of a transaction.
+ * The parent and the node itself are wrlocked, the remaining nodes are rdlocked
+ * (the same nodes lockPath locks for create/delete/move).
+ * @param path: path used by an operation of the transaction
+ * @param locks: set of lock requests
+ * @param counter: number of lock requests in the set
+ * @return new number of lock requests in the set
+*/
+int add_tx_locks(char *path, tx_lock *locks, int counter){
+
+	char full_path[MAX_FILE_NAME], prefix[MAX_FILE_NAME];
+	char delim[] = "/";
+	char *saveptr;
+	int nNodes = countiNodes(path);
+
+	strcpy(full_path, path);
+	prefix[0] = '\0';
+
+	char *node = NULL;
+	for (int depth = 0; depth <= nNodes; depth++) {
+		char mode = depth >= nNodes - 1 ? 'w' : 'r';
+		int i;
+
+		if (depth > 0) {
+			node = strtok_r(depth == 1 ? full_path : NULL, delim, &saveptr);
+			strcat(prefix, "/");
+			strcat(prefix, node);
+		}
+
+		for (i = 0; i < counter; i++) {
+			if (strcmp(locks[i].path, prefix) == 0) {
+				if (mode == 'w')
+					locks[i].mode = 'w';
+				break;
+			}
+		}
+		if (i == counter) {
+			strcpy(locks[counter].path, prefix);
+			locks[counter].depth = depth;
+			locks[counter].mode = mode;
+			counter++;
+		}
+	}
+	return counter;
+}
+
+/**
+ * Undoes the changes made by an operation of a transaction.
+ * @param record: record of the operation
+*/
+void undo_tx_record(tx_record *record){
+	switch (record->token) {
+		case 'c':
+			dir_reset_entry(record->parent_inumber, record->child_inumber);
+			inode_delete(record->child_inumber);
+			break;
+		case 'd':
+			dir_add_entry(record->parent_inumber, record->child_inumber, record->child_name);
+			break;
+		case 'm':
+			dir_reset_entry(record->parent_inumber_dest, record->child_inumber);
+			dir_add_entry(record->parent_inumber, record->child_inumber, record->child_name);
+			break;
+	}
+}
+
+/**
+ * Applies a list of create/delete/move operations atomically.
+ * The locks needed by all operations are computed first and acquired once,
+ * from the root down (alphabetically between nodes with the same depth), so
+ * transactions can not deadlock with each other nor with single operations.
+ * If an operation fails, the ones already applied are undone in reverse order.
+ * @param ops: operations of the transaction
+ * @param numOps: number of operations
+ * @return SUCCESS or FAIL
+*/
+int transaction(tx_op *ops, int numOps){
+
+	int numLocks = 0, size = 0, applied, result = SUCCESS;
+	int locked_inodes[INODE_TABLE_SIZE];
+	int maxLocks = 0;
+
+	if (numOps <= 0 || numOps > MAX_TRANSACTION_OPS)
+		return FAIL;
+
+	for (int i = 0; i < numOps; i++) {
+		maxLocks += countiNodes(ops[i].path) + 1;
+		if (ops[i].token == 'm')
+			maxLocks += countiNodes(ops[i].dest) + 1;
+	}
+
+	tx_lock *locks = (tx_lock*) malloc(sizeof(tx_lock) * maxLocks);
+	tx_record *records = (tx_record*) malloc(sizeof(tx_record) * numOps);
+	if (locks == NULL || records == NULL) {
+		fprintf(stderr, "Error: transaction malloc error\n");
+		exit(EXIT_FAILURE);
+	}
+
+	ebr_enter();
+
+	/* as in create, waits for free slots before taking any lock */
+	for (int i = 0; i < numOps; i++) {
+		if (ops[i].token == 'c') {
+			inode_reclaim();
+			break;
+		}
+	}
+
+	for (int i = 0; i < numOps; i++) {
+		numLocks = add_tx_locks(ops[i].path, locks, numLocks);
+		if (ops[i].token == 'm')
+			numLocks = add_tx_locks(ops[i].dest, locks, numLocks);
+	}
+	qsort(locks, numLocks, sizeof(tx_lock), compare_tx_locks);
+
+	/* every ancestor of a node is locked before it, so the lookup is safe */
+	for (int i = 0; i < numLocks; i++) {
+		int inumber = lookup(locks[i].path, 'l');
+
+		/* nodes that don't exist yet are protected by their wrlocked parent */
+		if (inumber == FAIL)
+			continue;
+		inode_lock(inumber, locks[i].mode == 'w' ? "w" : "r");
+		locked_inodes[size++] = inumber;
+	}
+
+	for (applied = 0; applied < numOps; applied++) {
+		tx_op *op = &ops[applied];
+
+		switch (op->token) {
+			case 'c':
+				result = apply_create(op->path, op->nodeType, &records[applied]);
+				break;
+			case 'd':
+				result = apply_delete(op->path, &records[applied]);
+				break;
+			case 'm':
+				if (verifyLoop(op->path, op->dest) == FAIL) {
+					FS_LOG("failed to move, cannot move %s to a subdirectory of itself, %s\n", op->path, op->dest);
+					result = FAIL;
+				}
+				else
+					result = apply_move(op->path, op->dest, &records[applied]);
+				break;
+			default:
+				result = FAIL;
+		}
+		if (result == FAIL)
+			break;
+	}
+
+	if (result == FAIL) {
+		FS_LOG("transaction failed at operation %d, rolling back\n", applied + 1);
+		for (applied--; applied >= 0; applied--)
+			undo_tx_record(&records[applied]);
+	}
+	else {
+		/* deleted inodes are only released once the transaction commits */
+		for (int i = 0; i < numOps; i++) {
+			if (records[i].token == 'd')
+				inode_delete(records[i].child_inumber);
+		}
+	}
+
+	unlock(locked_inodes, size);
+	ebr_exit();
+
+	free(locks);
+	free(records);
+	return result;
+}
@@ -2,17 +2,96 @@
 #define FS_H
 #include "state.h"
 
+/*
+ * Operation of a transaction
+ */
+typedef struct tx_op {
+	char token;                 /* 'c', 'd' or 'm' */
+	char path[MAX_FILE_NAME];
+	char dest[MAX_FILE_NAME];   /* only used by move */
+	type nodeType;              /* only used by create */
+} tx_op;
+
+/*
+ * Changes made by an applied operation, used to roll back a transaction
+ */
+typedef struct tx_record {
+	char token;
+	int parent_inumber;
+	int child_inumber;
+	int parent_inumber_dest;    /* only used by move */
+	char child_name[MAX_FILE_NAME];
+} tx_record;
+
+/*
+ * Node of a path that a transaction needs to lock
+ */
+typedef struct tx_lock {
+	char path[MAX_FILE_NAME];
+	int depth;
+	char mode;                  /* 'r' or 'w' */
+} tx_lock;
+
+/* Maximum number of batches a combiner applies before releasing the directory */
+#define COMBINE_MAX_ROUNDS 8
+
+/*
+ * Create or delete published in the queue of a directory
+ */
+typedef struct combine_request {
+	char token;                 /* 'c' or 'd' */
+	char child_name[MAX_FILE_NAME];
+	type nodeType;              /* only used by create */
+	int result;
+	int done;
+	struct combine_request *next;
+} combine_request;
+
+/*
+ * Publication list of a directory, one per i-node
+ */
+typedef struct combine_queue {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	combine_request *pending;
+	int combining;              /* set while a thread applies the pending requests */
+} combine_queue;
+
+/*
+ * Entry of a directory listed by read_dir
+ */
+typedef struct dir_listing {
+	char name[MAX_FILE_NAME];
+	int inumber;
+	type nodeType;
+	int next;                   /* cursor that resumes the listing after this entry */
+} dir_listing;
+
+extern int big_reader_dirs;
+extern int combining_dirs;
+
 void init_fs();
 void destroy_fs();
 int is_dir_empty(DirEntry *dirEntries);
 int create(char *name, type nodeType);
+int apply_create(char *name, type nodeType, tx_record *record);
 int delete(char *name);
+int apply_delete(char *name, tx_record *record);
+int apply_combine_request(int parent_inumber, combine_request *request);
+int combine(char *name, char token, type nodeType);
 int lookup(char *name,char flag);
 int verifyLoop(char* path,char* dest);
 int move(char* path, char* dest);
+int apply_move(char* path, char* dest, tx_record *record);
 int countiNodes(char* fullpath);
 int lockPath(char* name, int* array, char* arg);
 void unlock(int* array, int counter);
+int read_dir(char *name, int cursor, dir_listing *entries, int max, int *next);
+int stat_node(char *name, node_stat *st);
 int print_tecnicofs_tree(char* file);
+int compare_tx_locks(const void *a, const void *b);
+int add_tx_locks(char *path, tx_lock *locks, int counter);
+void undo_tx_record(tx_record *record);
+int transaction(tx_op *ops, int numOps);
 
 #endif /* FS_H */
@@ -3,7 +3,10 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
 #include "../tecnicofs-api-constants.h"
+#include "brlock.h"
+#include "ebr.h"
 
 /* FS root inode number */
 #define FS_ROOT 0
@@ -12,10 +15,22 @@
 #define INODE_TABLE_SIZE 50
 #define MAX_DIR_ENTRIES 20
 
+/* Times inode_reclaim waits for retired slots to be released */
+#define EBR_CREATE_ATTEMPTS 16
+
 #define SUCCESS 0
 #define FAIL -1
 
+#ifndef DELAY
 #define DELAY 50000000
+#endif
+
+/* diagnostics of the fs, left out of the embedded library (QUIET) so they do not reach the output of its host */
+#ifdef QUIET
+#define FS_LOG(...) ((void) 0)
+#else
+#define FS_LOG(...) printf(__VA_ARGS__)
+#endif
 
 
 /*
@@ -34,6 +49,16 @@ union Data {
 	DirEntry *dirEntries; /* for directories */
 };
 
+/*
+ * State of an i-node before it was changed, kept while a snapshot may need it
+ */
+typedef struct inode_version {
+	long epoch; /* first epoch in which the i-node no longer had this state */
+	type nodeType;
+	DirEntry *dirEntries; /* copy of the entries (directories only) */
+	struct inode_version *next; /* older version */
+} inode_version;
+
 /*
  * I-node definition
  */
@@ -41,21 +66,47 @@ typedef struct inode_t {
 	type nodeType;
 	union Data data;
 	pthread_rwlock_t rwl;
+	brlock *brl; /* used instead of rwl if big_reader is set */
+	int big_reader;
+	pthread_mutex_t vlock; /* protects nodeType, data and versions against snapshot readers */
+	int retired; /* deleted, but the slot can't be reused until released by ebr */
+	long mod_epoch; /* last epoch in which the i-node was changed */
+	inode_version *versions;
+	unsigned generation; /* times the slot was allocated, tells apart the i-nodes that reused it */
 } inode_t;
 
+/*
+ * Attributes of an i-node, filled by inode_stat
+ */
+typedef struct node_stat {
+	type nodeType;
+	int size; /* entries of a directory, bytes of a file */
+	unsigned generation;
+} node_stat;
+
 
 void insert_delay(int cycles);
 void inode_table_init();
 void inode_table_destroy();
+void inode_reclaim();
 int inode_create(type nType);
 int inode_delete(int inumber);
+void inode_release(void *ptr);
 int inode_get(int inumber, type *nType, union Data *data);
+int inode_stat(int inumber, node_stat *st);
 int inode_set_file(int inumber, char *fileContents, int len);
 int dir_reset_entry(int inumber, int sub_inumber);
 int dir_add_entry(int inumber, int sub_inumber, char *sub_name);
-void inode_print_tree(FILE *fp, int inumber, char *name);
+void inode_save_version(int inumber);
+void inode_prune_versions(int inumber, long oldest);
+int inode_get_snapshot(int inumber, long epoch, type *nType, DirEntry *entries);
+void inode_print_tree(FILE *fp, int inumber, char *name, long epoch);
+long snapshot_pin();
+void snapshot_unpin(long epoch);
+long snapshot_oldest();
 int inode_lock(int inumber,char* flag);
 int inode_unlock(int inumber);
+void inode_set_big_reader(int inumber, int enable);
 pthread_rwlock_t* getlock(int inumber);
 
 #endif /* INODES_H */
@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include "lease.h"
+#include "stats.h"
+
+/*
+ * Leases on the lookups of a path and of the paths under it. A client may
+ * answer a lookup from its cache while its lease lasts, so a delete or move
+ * first stops granting leases under its path and waits for the leases of
+ * other clients to expire. A lease is only recorded once its lookup
+ * succeeded, so every lease waited for is held by a client. An entry is
+ * freed once it expired and no mutation is waiting on it.
+ */
+typedef struct lease {
+	struct lease *next;
+	long expiry;          /* nanoseconds, of the latest lease on the path or under it */
+	uint32_t owner;       /* client holding every lease, LEASE_SHARED if several */
+	int revoking;         /* deletes and moves of the path in progress */
+	char path[];
+} lease;
+
+typedef struct lease_bucket {
+	pthread_mutex_t mutex;
+	lease *head;
+	long revocations;     /* deletes and moves started on the paths of the bucket */
+} lease_bucket;
+
+static lease_bucket buckets[LEASE_BUCKETS];
+static long lease_duration = 0;   /* microseconds, 0 if leases are not granted */
+
+/**
+ * Initializes the table of leases.
+ * @param duration: microseconds each lease lasts, 0 to grant none
+*/
+void lease_init(long duration) {
+	lease_duration = duration;
+	for (int i = 0; i < LEASE_BUCKETS; i++) {
+		if (pthread_mutex_init(&buckets[i].mutex, NULL) != 0) {
+			fprintf(stderr, "Error: mutex init error\n");
+			exit(EXIT_FAILURE);
+		}
+		buckets[i].head = NULL;
+		buckets[i].revocations = 0;
+	}
+}
+
+/**
+ * Returns the current time of the monotonic clock, shared with the clients.
+*/
+static long lease_now() {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+/**
+ * Hashes the first characters of a path (djb2).
+ * @param path: path
+ * @param length: characters hashed
+*/
+static unsigned lease_hash(char *path, int length) {
+	unsigned hash = 5381;
+
+	for (int i = 0; i < length; i++)
+		hash = hash * 33 + (unsigned char) path[i];
+	return hash % LEASE_BUCKETS;
+}
+
+/**
+ * Finds the entry of a path, freeing the expired entries met on the way.
+ * @param bucket: bucket of the path, locked
+ * @param path: path, of which only the first characters are used
+ * @param length: characters of the path
+ * @param now: current time
+ * @param create: whether to create the entry if there is none
+ * @return entry, or NULL if there is none and create is not set
+*/
+static lease *lease_find(lease_bucket *bucket, char *path, int length, long now, int create) {
+	lease **prev = &bucket->head, *l;
+
+	while ((l = *prev) != NULL) {
+		if (!strncmp(l->path, path, length) && l->path[length] == '\0')
+			return l;
+		if (l->expiry <= now && l->revoking == 0) {
+			*prev = l->next;
+			free(l);
+		}
+		else
+			prev = &l->next;
+	}
+	if (!create)
+		return NULL;
+
+	if ((l = (lease *) malloc(sizeof(lease) + length + 1)) == NULL) {
+		fprintf(stderr, "Error: lease allocation error\n");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(l->path, path, length);
+	l->path[length] = '\0';
+	l->expiry = 0;
+	l->owner = LEASE_SHARED;
+	l->revoking = 0;
+	l->next = bucket->head;
+	bucket->head = l;
+	return l;
+}
+
+/**
+ * Returns the length of the parent directory of a path.
+ * @param path: path
+ * @param length: characters of the path
+ * @return characters of the parent, 0 for the root
+*/
+static int lease_parent(char *path, int length) {
+	while (length > 0 && path[length - 1] != '/')
+		length--;
+	return length > 0 ? length - 1 : 0;
+}
+
+/**
+ * Starts a lookup that asks for a lease: notes the deletes and moves started
+ * so far on the path and on the directories above it, which lease_grant
+ * compares once the lookup is done.
+ * @param path: path looked up
+ * @param ticket: where the state is noted
+ * @return 1, or 0 if leases are not granted or a delete or move is in progress
+*/
+int lease_begin(char *path, lease_ticket *ticket) {
+	long now;
+	int granted = 1;
+
+	if (lease_duration == 0)
+		return 0;
+	now = lease_now();
+	ticket->buckets = 0;
+
+	for (int length = strlen(path); length > 0 && granted; length = lease_parent(path, length)) {
+		unsigned b = lease_hash(path, length);
+		lease_bucket *bucket = &buckets[b];
+
+		pthread_mutex_lock(&bucket->mutex);
+		lease *l = lease_find(bucket, path, length, now, 0);
+		if (l != NULL && l->revoking)
+			granted = 0;
+		ticket->buckets |= 1ULL << b;
+		ticket->revocations[b] = bucket->revocations;
+		pthread_mutex_unlock(&bucket->mutex);
+	}
+	if (!granted)
+		stats_add(&stats.leases_refused, 1);
+	return granted;
+}
+
+/**
+ * Grants a lease on a path after its lookup succeeded, unless a delete or
+ * move of the path or of a directory above it started since lease_begin: the
+ * result may then be stale. The buckets are locked together, in order, so the
+ * path and every directory above it record the lease, or none does.
+ * @param path: path looked up
+ * @param owner: client asking for the lease
+ * @param ticket: state noted by lease_begin
+ * @return microseconds the lease lasts, or 0 if it was not granted
+*/
+uint32_t lease_grant(char *path, uint32_t owner, lease_ticket *ticket) {
+	long now, expiry;
+	int granted = 1;
+
+	for (int b = 0; b < LEASE_BUCKETS; b++) {
+		if (ticket->buckets & (1ULL << b)) {
+			pthread_mutex_lock(&buckets[b].mutex);
+			if (buckets[b].revocations != ticket->revocations[b])
+				granted = 0;
+		}
+	}
+
+	now = lease_now();
+	expiry = now + lease_duration * 1000;
+	for (int length = strlen(path); length > 0 && granted; length = lease_parent(path, length)) {
+		lease *l = lease_find(&buckets[lease_hash(path, length)], path, length, now, 1);
+
+		if (l->expiry <= now)
+			l->owner = owner;
+		else if (l->owner != owner)
+			l->owner = LEASE_SHARED;
+		if (expiry > l->expiry)
+			l->expiry = expiry;
+	}
+
+	for (int b = 0; b < LEASE_BUCKETS; b++)
+		if (ticket->buckets & (1ULL << b))
+			pthread_mutex_unlock(&buckets[b].mutex);
+	stats_add(granted ? &stats.leases : &stats.leases_refused, 1);
+	return granted ? lease_duration : 0;
+}
+
+/**
+ * Stops granting leases on a path and on the paths under it, and waits for
+ * the leases of other clients on them to expire: those clients answer the
+ * lookups from their cache and can not be told to drop them. The leases of
+ * the client making the change are not waited for, it dropped them itself.
+ * Every call is followed by lease_release once the change is done.
+ * @param path: path deleted or moved
+ * @param owner: client making the change, LEASE_SHARED if unknown
+*/
+void lease_revoke(char *path, uint32_t owner) {
+	struct timespec until;
+	long now, wait = 0;
+	int length = strlen(path);
+
+	if (lease_duration == 0)
+		return;
+	now = lease_now();
+
+	lease_bucket *bucket = &buckets[lease_hash(path, length)];
+	pthread_mutex_lock(&bucket->mutex);
+	lease *l = lease_find(bucket, path, length, now, 1);
+	l->revoking++;
+	/* a lookup in progress on the path or under it is not granted a lease */
+	bucket->revocations++;
+	if (l->expiry > now && (l->owner != owner || owner == LEASE_SHARED))
+		wait = l->expiry;
+	pthread_mutex_unlock(&bucket->mutex);
+
+	if (wait == 0)
+		return;
+	stats_add(&stats.lease_waits, 1);
+	until.tv_sec = wait / 1000000000L;
+	until.tv_nsec = wait % 1000000000L;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR)
+		;
+}
+
+/**
+ * Grants leases on a path again after a delete or move.
+ * @param path: path given to lease_revoke
+*/
+void lease_release(char *path) {
+	int length = strlen(path);
+
+	if (lease_duration == 0)
+		return;
+
+	lease_bucket *bucket = &buckets[lease_hash(path, length)];
+	pthread_mutex_lock(&bucket->mutex);
+	/* the entry is kept while revoking is set */
+	lease *l = lease_find(bucket, path, length, lease_now(), 0);
+	l->revoking--;
+	pthread_mutex_unlock(&bucket->mutex);
+}
@@ -0,0 +1,24 @@
+#ifndef LEASE_H
+#define LEASE_H
+
+#include <stdint.h>
+
+#define LEASE_BUCKETS 64 /* at most 64, the buckets of a path are a mask */
+#define LEASE_SHARED 0    /* owner of leases held by several clients, or by an unknown one */
+
+/*
+ * Deletes and moves started in the buckets of a path and of the directories
+ * above it when its lookup began
+ */
+typedef struct lease_ticket {
+	uint64_t buckets;                     /* buckets of the path and its directories */
+	long revocations[LEASE_BUCKETS];
+} lease_ticket;
+
+void lease_init(long duration);
+int lease_begin(char *path, lease_ticket *ticket);
+uint32_t lease_grant(char *path, uint32_t owner, lease_ticket *ticket);
+void lease_revoke(char *path, uint32_t owner);
+void lease_release(char *path);
+
+#endif /* LEASE_H */
@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <string.h>
+#include "../fs/operations.h"
+
+/* only the calls of the client library are exported by libtecnicofs.so */
+#pragma GCC visibility push(default)
+#include "../../client/client/tecnicofs-client-api.h"
+#pragma GCC visibility pop
+
+/*
+ * Embedded TecnicoFS: the synchronous calls of the client library, executed
+ * in the calling thread directly on the file system linked in the program,
+ * without a server or a socket. Any number of threads may call them at once.
+ */
+
+static int mounted = 0;
+
+/**
+ * Copies a path given by the caller, which the file system may not change.
+ * @param path: path
+ * @param copy: buffer with MAX_FILE_NAME bytes
+ * @return SUCCESS, or FAIL if the path is too long
+*/
+static int copyPath(char *path, char *copy) {
+	if (path == NULL || strlen(path) >= MAX_FILE_NAME)
+		return FAIL;
+	strcpy(copy, path);
+	return SUCCESS;
+}
+
+int tfsMount(char *serverName) {
+	if (mounted)
+		return TECNICOFS_ERROR_OPEN_SESSION;
+	init_fs();
+	mounted = 1;
+	return EXIT_SUCCESS;
+}
+
+int tfsUnmount() {
+	if (!mounted)
+		return TECNICOFS_ERROR_NO_OPEN_SESSION;
+	mounted = 0;
+	destroy_fs();
+	return EXIT_SUCCESS;
+}
+
+int tfsCreate(char *path, char nodeType) {
+	char name[MAX_FILE_NAME];
+
+	if (!mounted)
+		return TECNICOFS_ERROR_NO_OPEN_SESSION;
+	if ((nodeType != 'f' && nodeType != 'd') || copyPath(path, name) == FAIL)
+		return TECNICOFS_ERROR_OTHER;
+	return create(name, nodeType == 'd' ? T_DIRECTORY : T_FILE);
+}
+
+int tfsDelete(char *path) {
+	char name[MAX_FILE_NAME];
+
+	if (!mounted)
+		return TECNICOFS_ERROR_NO_OPEN_SESSION;
+	if (copyPath(path, name) == FAIL)
+		return TECNICOFS_ERROR_OTHER;
+	return delete(name);
+}
+
+int tfsLookup(char *path) {
+	char name[MAX_FILE_NAME];
+	int result;
+
+	if (!mounted)
+		return TECNICOFS_ERROR_NO_OPEN_SESSION;
+	if (copyPath(path, name) == FAIL)
+		return TECNICOFS_ERROR_OTHER;
+
+	/* as in the server, deleted i-nodes are not released while the lookup runs */
+	ebr_enter();
+	result = lookup(name, 'u');
+	ebr_exit();
+	return result;
+}
+
+int tfsMove(char *from, char *to) {
+	char path[MAX_FILE_NAME], dest[MAX_FILE_NAME];
+
+	if (!mounted)
+		return TECNICOFS_ERROR_NO_OPEN_SESSION;
+	if (copyPath(from, path) == FAIL || copyPath(to, dest) == FAIL)
+		return TECNICOFS_ERROR_OTHER;
+	return move(path, dest);
+}
+
+int tfsPrint(char *file) {
+	if (!mounted)
+		return TECNICOFS_ERROR_NO_OPEN_SESSION;
+	return print_tecnicofs_tree(file);
+}
+
+/**
+ * Lists a page of the entries of a directory, as tfsReaddir of the client
+ * library, with up to MAX_DIR_ENTRIES entries per call.
+ * @param path: path of the directory
+ * @param cursor: 0 to start the listing, then the value left by the previous
+ *                call; set to 0 once the listing is complete
+ * @param entries: where the entries are stored
+ * @param max: entries listed at most
+ * @return number of entries listed, or an error
+*/
+int tfsReaddir(char *path, int *cursor, tfs_dirent_info entries[], int max) {
+	char name[MAX_FILE_NAME];
+	dir_listing listing[MAX_DIR_ENTRIES];
+	int count, next;
+
+	if (!mounted)
+		return TECNICOFS_ERROR_NO_OPEN_SESSION;
+	if (*cursor < 0 || max <= 0 || copyPath(path, name) == FAIL)
+		return TECNICOFS_ERROR_OTHER;
+	if (max > MAX_DIR_ENTRIES)
+		max = MAX_DIR_ENTRIES;
+
+	if ((count = read_dir(name, *cursor, listing, max, &next)) < 0)
+		return count;
+	for (int i = 0; i < count; i++) {
+		strcpy(entries[i].name, listing[i].name);
+		entries[i].inumber = listing[i].inumber;
+		entries[i].nodeType = listing[i].nodeType;
+	}
+	*cursor = next;
+	return count;
+}
+
+int tfsStat(char *path, tfs_stat *st) {
+	char name[MAX_FILE_NAME];
+	node_stat attributes;
+	int result;
+
+	if (!mounted)
+		return TECNICOFS_ERROR_NO_OPEN_SESSION;
+	if (copyPath(path, name) == FAIL)
+		return TECNICOFS_ERROR_OTHER;
+
+	if ((result = stat_node(name, &attributes)) >= 0) {
+		st->inumber = result;
+		st->nodeType = attributes.nodeType;
+		st->size = attributes.size;
+		st->generation = attributes.generation;
+	}
+	return result;
+}
+
+/**
+ * Applies a list of create/delete/move commands atomically, as
+ * tfsTransaction of the client library.
+ * @param commands: array of commands in the format of the input file
+ * @param numCommands: number of commands
+ * @return 0 if every command was applied, otherwise none was applied
+*/
+int tfsTransaction(char *commands[], int numCommands) {
+	tx_op ops[MAX_TRANSACTION_OPS];
+	char arg2[MAX_INPUT_SIZE];
+
+	if (!mounted)
+		return TECNICOFS_ERROR_NO_OPEN_SESSION;
+	if (numCommands <= 0 || numCommands > MAX_TRANSACTION_OPS)
+		return TECNICOFS_ERROR_OTHER;
+
+	for (int i = 0; i < numCommands; i++) {
+		tx_op *op = &ops[i];
+		int numTokens;
+
+		if (strlen(commands[i]) >= MAX_INPUT_SIZE)
+			return TECNICOFS_ERROR_OTHER;
+		op->token = '\0';
+		numTokens = sscanf(commands[i], "%c %s %s", &op->token, op->path, arg2);
+		if (op->token == 'c' && numTokens == 3 && (arg2[0] == 'f' || arg2[0] == 'd'))
+			op->nodeType = arg2[0] == 'd' ? T_DIRECTORY : T_FILE;
+		else if (op->token == 'm' && numTokens == 3)
+			strcpy(op->dest, arg2);
+		else if (op->token != 'd' || numTokens != 2)
+			return TECNICOFS_ERROR_OTHER;
+	}
+	return transaction(ops, numCommands);
+}
+
+/* every call is applied before it returns, there is nothing to write behind */
+
+int tfsWriteBehind(int batchSize) {
+	if (!mounted)
+		return TECNICOFS_ERROR_NO_OPEN_SESSION;
+	return batchSize < 0 || batchSize > MAX_TRANSACTION_OPS ? TECNICOFS_ERROR_OTHER : EXIT_SUCCESS;
+}
+
+int tfsFlush() {
+	return mounted ? EXIT_SUCCESS : TECNICOFS_ERROR_NO_OPEN_SESSION;
+}
+
+int tfsSync() {
+	return mounted ? 0 : TECNICOFS_ERROR_NO_OPEN_SESSION;
+}
@@ -1,11 +1,25 @@
+#define _GNU_SOURCE /* recvmmsg, sendmmsg and pthread_attr_setaffinity_np */
 #include <stdio.h>
 #include <stdlib.h>
 #include <getopt.h>
 #include <string.h>
 #include <ctype.h>
 #include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <errno.h>
 #include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <poll.h>
 #include "fs/operations.h"
+#include "protocol.h"
+#include "queue.h"
+#include "shm.h"
+#include "stats.h"
+#include "uring.h"
+#include "flight.h"
+#include "lease.h"
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -13,137 +27,1034 @@
 #include <unistd.h>
 #include <sys/stat.h>
 
-#define MAX_INPUT_SIZE 100
+/* how requests are received from the socket */
+typedef enum io_backend { IO_BLOCKING, IO_EPOLL, IO_BATCH, IO_CONNECTION, IO_URING } io_backend;
+
+#define DEFAULT_BATCH_SIZE 16
+#define MAX_BATCH_SIZE 1024
+#define SESSION_BURST 16  //requests received from a connection before serving others
+#define SESSION_EVENTS 64  //connections handled per epoll_wait
+#define URING_SENDS 64  //replies each thread of the io_uring backend sends at the same time
+#define URING_RECEIVE ((__u64) -1)  //user_data of the multishot receive
+#define URING_STOP ((__u64) -2)  //user_data of the poll on stop_fd
+#define URING_CANCEL ((__u64) -3)  //user_data of the cancellation of the receive
+
+/*
+ * State of a client connected to the server (connection backend).
+ * The I/O thread holds a reference until the client disconnects and every
+ * request waiting for a reply holds another one.
+ */
+typedef struct session {
+    int fd;
+    long id;
+    long requests;       //requests received
+    int refs;
+} session;
+
+/*
+ * Reply to a request of a shared memory session, waited for by the thread of
+ * the session while a worker executes the request.
+ */
+typedef struct shm_waiter {
+    pthread_mutex_t mutex;
+    pthread_cond_t replied;
+    int done;
+    int size;
+    char* reply;
+} shm_waiter;
+
+/*
+ * Reply being sent by the io_uring backend, which must stay valid until
+ * its sendmsg completes.
+ */
+typedef struct uring_send {
+    struct msghdr msg;
+    struct iovec iov;
+    struct sockaddr_un addr;
+    struct timespec received;
+    char reply[TFS_MAX_REPLY_SIZE];
+} uring_send;
 
 int sockfd; //server file descriptor
+io_backend backend = IO_BLOCKING;
+int batch_size = DEFAULT_BATCH_SIZE; //requests per recvmmsg of the batched backend
+int class_bounds[NUM_CLASSES] = { QUEUE_SIZE, QUEUE_SIZE, BULK_QUEUE_SIZE }; //requests queued per class
+int class_limits[NUM_CLASSES] = { 0, 0, 1 }; //requests executed per class, 0 for every thread
+request_queue requests; //requests received by the I/O thread of the epoll backend
+int connections_epfd; //connections waiting for requests (connection backend)
+long sessions = 0; //connections accepted
+int single_flight = 0; //identical lookups in flight are executed once
+long lease_ms = 0; //how long the leases granted on lookups last, 0 to grant none
+int cpus[CPU_SETSIZE]; //CPUs the threads are pinned to, in order
+int numcpus = 0; //0 if the threads are not pinned
+int threads_created = 0; //threads pinned so far, the next one takes cpus[threads_created % numcpus]
+int stopping = 0; //set on SIGINT or SIGTERM, before the socket is shut down
+int stop_fd = -1; //eventfd written when the server stops, polled by the io_uring backend
+
+/**
+ * Checks whether the server is stopping, in which case a receive that
+ * returns 0 means the socket was shut down.
+*/
+int serverStopping(){
+    return __atomic_load_n(&stopping, __ATOMIC_ACQUIRE);
+}
 
 void errorParse(){
     fprintf(stderr, "Error: command invalid\n");
     exit(EXIT_FAILURE);
 } 
 
+int handleMessage(char* input, int length, char* reply);
+int handleShmRequest(request* req, char* reply);
+
+/**
+ * Looks up a path, as the requests of clients do.
+ * @param path: path
+*/
+int lookupPath(char* path){
+    return lookup(path, 'u');
+}
+
+int executeBatch(parsed_request* parsed);
+
+/**
+ * Executes a parsed request (or transaction, or batch).
+ * @param parsed: parsed request
+ * @return result sent back to the client
+*/
+int executeOperation(parsed_request* parsed){
+
+    int Result;
+
+    switch (parsed->token) {
+        case 'c':
+            if (parsed->nodeType == T_FILE)
+                printf("Create file: %s\n", parsed->path);
+            else
+                printf("Create directory: %s\n", parsed->path);
+            Result = create(parsed->path, parsed->nodeType);
+            break;
+        case 'l': {
+            int shared = 0;
+            lease_ticket ticket;
+
+            /* a delete or move that starts while the lookup runs refuses its lease */
+            if (parsed->lease)
+                parsed->lease = lease_begin(parsed->path, &ticket);
+            if (single_flight)
+                Result = flight_do(parsed->path, lookupPath, &shared);
+            else
+                Result = lookupPath(parsed->path);
+            stats_add(&stats.lookups, 1);
+            stats_add(&stats.coalesced, shared);
+            /* a result taken from a lookup that started earlier is not leased */
+            if (parsed->lease)
+                parsed->lease = Result >= 0 && !shared ? lease_grant(parsed->path, parsed->owner, &ticket) : 0;
+            if (Result >= 0)
+                printf("Search: %s found\n", parsed->path);
+            else
+                printf("Search: %s not found\n", parsed->path);
+            break;
+        }
+        case 'd':
+            printf("Delete: %s\n", parsed->path);
+            lease_revoke(parsed->path, parsed->owner);
+            Result = delete(parsed->path);
+            lease_release(parsed->path);
+            break;
+        case 'm':
+            printf("Move: %s to %s\n",parsed->path,parsed->dest);
+            lease_revoke(parsed->path, parsed->owner);
+            Result = move(parsed->path,parsed->dest);
+            lease_release(parsed->path);
+            break;
+        case 'r': {
+            int next;
+
+            printf("List: %s\n", parsed->path);
+            Result = read_dir(parsed->path, parsed->cursor, parsed->listing, parsed->count, &next);
+            parsed->cursor = next;
+            break;
+        }
+        case 'a':
+            printf("Stat: %s\n", parsed->path);
+            Result = stat_node(parsed->path, &parsed->st);
+            break;
+        case 'p':
+            printf("Print tree\n");
+            Result = print_tecnicofs_tree(parsed->path);
+            break;
+        case 's':
+            printf("Mount shared memory: %s\n", parsed->path);
+            Result = shm_session_open(parsed->path, handleShmRequest);
+            break;
+        case 't': {
+            tx_op ops[MAX_TRANSACTION_OPS];
+            int numOps = parseTransactionOps(parsed, ops);
+
+            printf("Transaction: %d operations\n", numOps);
+            for (int i = 0; i < numOps; i++)
+                if (ops[i].token != 'c')
+                    lease_revoke(ops[i].path, parsed->owner);
+            Result = numOps == FAIL ? FAIL : transaction(ops, numOps);
+            for (int i = 0; i < numOps; i++)
+                if (ops[i].token != 'c')
+                    lease_release(ops[i].path);
+            break;
+        }
+        case 'b':
+            printf("Batch: %d operations\n", parsed->numOps);
+            Result = executeBatch(parsed);
+            break;
+
+        default: { /* error */
+            fprintf(stderr, "Error: command to apply\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return Result;
+}
+
+/**
+ * Executes the operations of a batch in order, each one on its own: unlike
+ * in a transaction, an operation that fails does not undo or stop the others.
+ * Every operation is parsed before the first one is executed.
+ * @param parsed: parsed batch, whose results array receives each result
+ * @return number of operations executed or FAIL if the batch is malformed
+*/
+int executeBatch(parsed_request* parsed){
+
+    parsed_request op;
+    uint32_t offset = 0;
+
+    for (int i = 0; i < parsed->numOps; i++)
+        if (parseBatchOp(parsed, &offset, &op) == FAIL)
+            return FAIL;
+    if (offset != parsed->opsSize)
+        return FAIL;
+
+    offset = 0;
+    for (int i = 0; i < parsed->numOps; i++){
+        parseBatchOp(parsed, &offset, &op);
+        parsed->results[i] = executeOperation(&op);
+    }
+    return parsed->numOps;
+}
+
+/**
+ * Parses and executes a single request (or transaction, or batch).
+ * @param input: request received from a client, followed by a '\0'
+ * @param length: size of the request
+ * @param parsed: where the request is parsed to
+ * @return result sent back to the client
+*/
+int executeRequest(char* input, int length, parsed_request* parsed){
+
+    int Result;
+
+    /* a malformed request (or one with a path too long) is answered with an error, a client cannot stop the server */
+    if (parseRequest(input, length, parsed) == FAIL) {
+        if (!parsed->binary)
+            fprintf(stderr, "Error: invalid command in Queue\n");
+        return FAIL;
+    }
+
+    /* objects deleted by other threads are not released while this request runs */
+    ebr_enter();
+    Result = executeOperation(parsed);
+    ebr_exit();
+    return Result;
+}
+
+/**
+ * Executes a request and builds the reply to the client that made it.
+ * @param input: request received, followed by a '\0'
+ * @param length: size of the request
+ * @param reply: buffer with at least TFS_MAX_REPLY_SIZE bytes
+ * @return size of the reply
+*/
+int handleMessage(char* input, int length, char* reply){
+
+    parsed_request parsed;
+    int32_t results[MAX_TRANSACTION_OPS];
+    dir_listing listing[TFS_READDIR_MAX_ENTRIES];
+
+    parsed.results = results;
+    parsed.listing = listing;
+    int Result = executeRequest(input, length, &parsed);
+
+    return buildReply(&parsed, Result, reply);
+}
+
+/**
+ * Drops a reference to a session, closing its connection with the last one.
+ * @param s: session
+*/
+void releaseSession(session* s){
+    if (__atomic_sub_fetch(&s->refs, 1, __ATOMIC_ACQ_REL) == 0){
+        close(s->fd);
+        free(s);
+    }
+}
+
+/**
+ * Sends a reply to the client that made a request.
+ * @param req: request received
+ * @param reply: reply
+ * @param size: size of the reply
+*/
+void sendReply(request* req, char* reply, int size){
+
+    /* the thread of a shared memory session writes the reply to its segment */
+    if (req->waiter != NULL){
+        shm_waiter* w = (shm_waiter*) req->waiter;
+
+        memcpy(w->reply, reply, size);
+        pthread_mutex_lock(&w->mutex);
+        w->size = size;
+        w->done = 1;
+        pthread_cond_signal(&w->replied);
+        pthread_mutex_unlock(&w->mutex);
+        return;
+    }
+
+    /* sends the reply on sockfd to client_addr, or on the connection */
+    stats_add(&stats.syscalls, 1);
+    if (req->conn != NULL){
+        session* s = (session*) req->conn;
+
+        /* the connection is non-blocking, a client slow to take its replies is waited for */
+        while (send(s->fd, reply, size, MSG_NOSIGNAL) < 0){
+            if (errno != EAGAIN && errno != EWOULDBLOCK){
+                perror("server: send error");
+                break;
+            }
+            struct pollfd pfd = { s->fd, POLLOUT, 0 };
+            stats_add(&stats.syscalls, 2);
+            poll(&pfd, 1, -1);
+        }
+        releaseSession(s);
+    }
+    else if (sendto(sockfd, reply, size, 0, (struct sockaddr *)&req->client_addr, req->addrlen) < 0){
+        perror("server: sendto error");
+    }
+}
+
+/**
+ * Executes a request and sends the result to the client that made it.
+ * @param req: request received
+*/
+void replyRequest(request* req){
+
+    char reply[TFS_MAX_REPLY_SIZE];
+    int size = handleMessage(req->input, req->length, reply);
+
+    sendReply(req, reply, size);
+    stats_request(&req->received);
+}
+
+/**
+ * Finds the priority class of a request: lookups, readdirs and stats are reads,
+ * creates, deletes and moves are mutations, prints, transactions and mounts
+ * are bulk requests.
+ * @param req: request received
+*/
+request_class classifyRequest(request* req){
+    switch (requestToken(req->input, req->length)) {
+        case 'l':
+        case 'r':
+        case 'a':
+            return CLASS_READ;
+        case 'p':
+        case 't':
+        case 's':
+            return CLASS_BULK;
+        default:
+            return CLASS_MUTATE;
+    }
+}
+
+/**
+ * Moves a request to the queue of its class, or rejects it right away with
+ * TECNICOFS_ERROR_BUSY if that queue is full.
+ * @param req: request received
+*/
+void admitRequest(request* req){
+
+    char reply[TFS_MAX_REPLY_SIZE];
+
+    if (queue_insert(&requests, req, classifyRequest(req)) == FAIL)
+        sendReply(req, reply, buildErrorReply(req->input, req->length, TECNICOFS_ERROR_BUSY, reply));
+}
+
+/**
+ * Executes a request of a shared memory session, called by the thread of the
+ * session. With a request queue the request is admitted as if it came from
+ * the socket, so it takes its place in its priority class and may be rejected
+ * with TECNICOFS_ERROR_BUSY, and the thread waits for the worker to reply.
+ * Otherwise it is executed right away, as the threads of the socket do.
+ * @param req: request copied out of the segment
+ * @param reply: buffer with at least TFS_MAX_REPLY_SIZE bytes
+ * @return size of the reply
+*/
+int handleShmRequest(request* req, char* reply){
+
+    shm_waiter waiter;
+
+    if (backend != IO_EPOLL && backend != IO_CONNECTION){
+        int size = handleMessage(req->input, req->length, reply);
+        stats_request(&req->received);
+        return size;
+    }
+
+    waiter.done = 0;
+    waiter.reply = reply;
+    if (pthread_mutex_init(&waiter.mutex, NULL) != 0 || pthread_cond_init(&waiter.replied, NULL) != 0){
+        fprintf(stderr, "Error: shared memory request init error\n");
+        exit(EXIT_FAILURE);
+    }
+    req->conn = NULL;
+    req->waiter = &waiter;
+    admitRequest(req);
+
+    pthread_mutex_lock(&waiter.mutex);
+    while (!waiter.done)
+        pthread_cond_wait(&waiter.replied, &waiter.mutex);
+    pthread_mutex_unlock(&waiter.mutex);
+    pthread_mutex_destroy(&waiter.mutex);
+    pthread_cond_destroy(&waiter.replied);
+    return waiter.size;
+}
+
+/**
+ * Blocking backend: every thread waits in recvfrom on the server socket.
+*/
 void applyCommands(){
 
     int c;
-    socklen_t addrlen;
-    char input[MAX_INPUT_SIZE];
-    struct sockaddr_un client_addr;
-    addrlen=sizeof(struct sockaddr_un);
+    request req;
 
     while (1){
 
+        req.addrlen = sizeof(struct sockaddr_un);
+
         /* reads bytes into input through sockfd and returns the number of bytes read */
-        if ((c = recvfrom(sockfd, input, sizeof(input)-1, 0,(struct sockaddr *)&client_addr, &addrlen)) <= 0){
-            perror("server: recvfrom error");
+        stats_add(&stats.syscalls, 1);
+        if ((c = recvfrom(sockfd, req.input, sizeof(req.input)-1, 0,(struct sockaddr *)&req.client_addr, &req.addrlen)) <= 0){
+            if (!serverStopping())
+                perror("server: recvfrom error");
             break;
         }
+        clock_gettime(CLOCK_MONOTONIC, &req.received);
 
         /* always sets last char of input to '\0' */
-        input[c]='\0';
+        req.input[c]='\0';
+        req.length = c;
+        req.conn = NULL;
+        req.waiter = NULL;
 
-        int numTokens;
-        char token, type;
-        char name[MAX_INPUT_SIZE];
-        char path[MAX_INPUT_SIZE];
-        char pathdest[MAX_INPUT_SIZE];
+        replyRequest(&req);
+    }
+}
 
-        if(input[0] == 'm')
-            numTokens = sscanf(input, "%c %s %s", &token, path, pathdest); // different sscanf for move command
-        else
-            numTokens = sscanf(input, "%c %s %c", &token, name, &type);
+/**
+ * Auxiliar function called during thread create.
+*/
+void *applyCommands_aux(){
+    applyCommands();
+    return NULL;
+}
 
-        if (numTokens < 2) {
-            fprintf(stderr, "Error: invalid command in Queue\n");
+/**
+ * I/O thread of the epoll backend: waits until the socket is readable and
+ * drains every datagram into the request queue.
+*/
+void *receiveCommands(){
+
+    int c, epfd;
+    request received, *req = &received;
+    struct epoll_event event;
+
+    if ((epfd = epoll_create1(0)) < 0){
+        perror("server: epoll_create error");
+        exit(EXIT_FAILURE);
+    }
+    event.events = EPOLLIN;
+    event.data.fd = sockfd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, sockfd, &event) < 0){
+        perror("server: epoll_ctl error");
+        exit(EXIT_FAILURE);
+    }
+
+    while (!serverStopping()){
+        if (epoll_wait(epfd, &event, 1, -1) < 0){
+            if (errno == EINTR)
+                continue;
+            perror("server: epoll_wait error");
             exit(EXIT_FAILURE);
         }
+        stats_add(&stats.io_wakeups, 1);
+        stats_add(&stats.syscalls, 1);
 
-        int Result;
-        switch (token) {
-            case 'c':
-                switch (type) {
-                    case 'f':
-                        printf("Create file: %s\n", name);
-                        Result = create(name, T_FILE);
-                        break;
-                    case 'd':
-                        printf("Create directory: %s\n", name);
-                        Result = create(name, T_DIRECTORY);
-                        break;
-                    default:
-                        fprintf(stderr, "Error: invalid node type\n");
-                        exit(EXIT_FAILURE);
-                }
-                break;
-            case 'l': 
-                Result = lookup(name,'u');
-                if (Result >= 0)
-                    printf("Search: %s found\n", name);
-                else
-                    printf("Search: %s not found\n", name);
-                break;
-            case 'd':
-                printf("Delete: %s\n", name);
-                Result = delete(name);
+        /* every datagram is received before waiting again */
+        while (!serverStopping()){
+            req->addrlen = sizeof(struct sockaddr_un);
+            stats_add(&stats.syscalls, 1);
+            if ((c = recvfrom(sockfd, req->input, sizeof(req->input)-1, MSG_DONTWAIT,
+                    (struct sockaddr *)&req->client_addr, &req->addrlen)) < 0){
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    break;
+                perror("server: recvfrom error");
+                exit(EXIT_FAILURE);
+            }
+            if (c == 0 && serverStopping())
                 break;
-            case 'm':
-                printf("Move: %s to %s\n",path,pathdest);
-                Result = move(path,pathdest);
+            clock_gettime(CLOCK_MONOTONIC, &req->received);
+            req->input[c] = '\0';
+            req->length = c;
+            req->conn = NULL;
+            req->waiter = NULL;
+            admitRequest(req);
+        }
+    }
+    close(epfd);
+    return NULL;
+}
+
+/**
+ * Worker of the epoll backend: executes the requests inside the queue.
+*/
+void *workCommands(){
+
+    request req;
+    request_class class;
+
+    /* once the queue is closed, the requests left are executed before ending */
+    while ((class = queue_remove(&requests, &req)) != NUM_CLASSES){
+        replyRequest(&req);
+        queue_done(&requests, class);
+    }
+    return NULL;
+}
+
+/**
+ * Batched backend: every thread receives up to batch_size requests with a
+ * single recvmmsg, executes them and sends every reply with a single sendmmsg.
+*/
+void *batchCommands(){
+
+    int n, sent, size;
+    struct timespec received;
+    request* reqs = (request*) malloc(sizeof(request) * batch_size);
+    char (*replies)[TFS_MAX_REPLY_SIZE] = malloc(TFS_MAX_REPLY_SIZE * batch_size);
+    struct mmsghdr* in = (struct mmsghdr*) calloc(batch_size, sizeof(struct mmsghdr));
+    struct mmsghdr* out = (struct mmsghdr*) calloc(batch_size, sizeof(struct mmsghdr));
+    struct iovec* inVec = (struct iovec*) malloc(sizeof(struct iovec) * batch_size);
+    struct iovec* outVec = (struct iovec*) malloc(sizeof(struct iovec) * batch_size);
+
+    if (reqs == NULL || replies == NULL || in == NULL || out == NULL || inVec == NULL || outVec == NULL){
+        fprintf(stderr, "Error: batch allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < batch_size; i++){
+        inVec[i].iov_base = reqs[i].input;
+        inVec[i].iov_len = sizeof(reqs[i].input) - 1;
+        in[i].msg_hdr.msg_iov = &inVec[i];
+        in[i].msg_hdr.msg_iovlen = 1;
+        in[i].msg_hdr.msg_name = &reqs[i].client_addr;
+        outVec[i].iov_base = replies[i];
+        out[i].msg_hdr.msg_iov = &outVec[i];
+        out[i].msg_hdr.msg_iovlen = 1;
+        out[i].msg_hdr.msg_name = &reqs[i].client_addr;
+    }
+
+    while (!serverStopping()){
+        for (int i = 0; i < batch_size; i++)
+            in[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_un);
+
+        /* waits for the first request and takes every other one already queued */
+        stats_add(&stats.syscalls, 1);
+        if ((n = recvmmsg(sockfd, in, batch_size, MSG_WAITFORONE, NULL)) <= 0){
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (serverStopping())
                 break;
-            case 'p':
-                printf("Print tree\n");
-                Result = print_tecnicofs_tree(name);
+            perror("server: recvmmsg error");
+            exit(EXIT_FAILURE);
+        }
+        /* once the socket is shut down, the receives after the last request return 0 bytes */
+        if (serverStopping()){
+            while (n > 0 && in[n - 1].msg_len == 0)
+                n--;
+            if (n == 0)
                 break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &received);
 
-            default: { /* error */
-                fprintf(stderr, "Error: command to apply\n");
-                exit(EXIT_FAILURE);
+        for (int i = 0; i < n; i++){
+            reqs[i].length = in[i].msg_len;
+            reqs[i].input[reqs[i].length] = '\0';
+            reqs[i].addrlen = in[i].msg_hdr.msg_namelen;
+            reqs[i].received = received;
+            size = handleMessage(reqs[i].input, reqs[i].length, replies[i]);
+            outVec[i].iov_len = size;
+            out[i].msg_hdr.msg_namelen = reqs[i].addrlen;
+        }
+
+        /* sendmmsg may send only part of the replies */
+        for (sent = 0; sent < n; ){
+            stats_add(&stats.syscalls, 1);
+            int c = sendmmsg(sockfd, out + sent, n - sent, 0);
+            if (c < 0){
+                perror("server: sendmmsg error");
+                /* the reply that failed is skipped */
+                c = 1;
             }
+            sent += c;
         }
-        /* sends bytes of Result on sockfd to client_addr */
-        if (sendto(sockfd, &Result, sizeof(Result), 0, (struct sockaddr *)&client_addr, addrlen) < 0){
-            perror("server: sendto error");
+        for (int i = 0; i < n; i++)
+            stats_request(&reqs[i].received);
+    }
+    free(reqs);
+    free(replies);
+    free(in);
+    free(out);
+    free(inVec);
+    free(outVec);
+    return NULL;
+}
+
+/**
+ * Executes a request received by the multishot recvmsg of the io_uring
+ * backend, in place inside its provided buffer, and queues the reply.
+ * @param recvMsg: message header the receive was armed with
+ * @param buffer: provided buffer holding the request
+ * @param send: where the reply is built
+ * @param received: instant when the request was received
+*/
+void uringRequest(struct msghdr* recvMsg, char* buffer, uring_send* send, struct timespec* received){
+
+    struct io_uring_recvmsg_out* out = (struct io_uring_recvmsg_out*) buffer;
+    char* name = buffer + sizeof(struct io_uring_recvmsg_out);
+    char* input = name + recvMsg->msg_namelen + recvMsg->msg_controllen;
+    int length = out->payloadlen < MAX_MESSAGE_SIZE ? out->payloadlen : MAX_MESSAGE_SIZE;
+
+    /* the buffer has room for a '\0' after the largest message */
+    input[length] = '\0';
+    send->msg.msg_namelen = out->namelen < recvMsg->msg_namelen ? out->namelen : recvMsg->msg_namelen;
+    memcpy(&send->addr, name, send->msg.msg_namelen);
+    send->iov.iov_len = handleMessage(input, length, send->reply);
+    send->received = *received;
+}
+
+/**
+ * io_uring backend: every thread owns a ring with a multishot recvmsg armed
+ * on the server socket, which writes each request into a buffer provided to
+ * the kernel. Replies are sent with sendmsg entries, submitted together with
+ * the wait for the next requests in a single io_uring_enter. They do not
+ * wait for room in the queue of the client: a unix datagram that the kernel
+ * retries after -EAGAIN is sent empty, the message having been consumed by
+ * the first attempt.
+*/
+void *uringCommands(){
+
+    uring ring;
+    struct msghdr recvMsg;
+    struct io_uring_sqe* sqe;
+    struct io_uring_cqe* cqe;
+    struct timespec received;
+    int armed = 0, numFree = URING_SENDS, freeSends[URING_SENDS];
+    uring_send* sends = (uring_send*) calloc(URING_SENDS + 1, sizeof(uring_send));
+    uring_send* direct = &sends[URING_SENDS]; //reply sent with sendmsg when every other one is in flight
+
+    if (sends == NULL){
+        fprintf(stderr, "Error: io_uring allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    if (uring_init(&ring, sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_un) + MAX_MESSAGE_SIZE + 1) == FAIL){
+        perror("server: io_uring setup error");
+        exit(EXIT_FAILURE);
+    }
+
+    /* each provided buffer holds the sender address followed by the request */
+    memset(&recvMsg, 0, sizeof(recvMsg));
+    recvMsg.msg_namelen = sizeof(struct sockaddr_un);
+    for (int i = 0; i <= URING_SENDS; i++){
+        sends[i].iov.iov_base = sends[i].reply;
+        sends[i].msg.msg_iov = &sends[i].iov;
+        sends[i].msg.msg_iovlen = 1;
+        sends[i].msg.msg_name = &sends[i].addr;
+        if (i < URING_SENDS)
+            freeSends[i] = i;
+    }
+
+    /* the server wakes the thread through stop_fd when it stops */
+    sqe = uring_get_sqe(&ring);
+    uring_prep_poll_add(sqe, stop_fd, POLLIN);
+    sqe->user_data = URING_STOP;
+
+    /* once the server stops, waits for the receive to end and for the replies in flight */
+    while (!serverStopping() || numFree < URING_SENDS || armed){
+        /* the receive ends when the kernel runs out of buffers */
+        if (!armed && !serverStopping()){
+            sqe = uring_get_sqe(&ring);
+            uring_prep_recvmsg_multishot(sqe, sockfd, &recvMsg);
+            sqe->user_data = URING_RECEIVE;
+            armed = 1;
+        }
+
+        stats_add(&stats.syscalls, 1);
+        if (uring_submit_and_wait(&ring, 1) == FAIL){
+            perror("server: io_uring_enter error");
+            exit(EXIT_FAILURE);
+        }
+        stats_add(&stats.io_wakeups, 1);
+        clock_gettime(CLOCK_MONOTONIC, &received);
+
+        while ((cqe = uring_peek_cqe(&ring)) != NULL){
+            if (cqe->user_data == URING_STOP){
+                /* the kernel stops writing to the buffers once the receive completes for the last time */
+                sqe = uring_get_sqe(&ring);
+                uring_prep_cancel(sqe, URING_RECEIVE);
+                sqe->user_data = URING_CANCEL;
+            }
+            else if (cqe->user_data == URING_CANCEL){
+                /* the receive itself completes with -ECANCELED */
+            }
+            else if (cqe->user_data != URING_RECEIVE){
+                /* a reply was sent */
+                uring_send* send = &sends[cqe->user_data];
+                if (cqe->res == -EAGAIN){
+                    /* the client is not receiving its replies, it is waited for as in recvfrom */
+                    stats_add(&stats.syscalls, 1);
+                    if (sendmsg(sockfd, &send->msg, 0) < 0)
+                        perror("server: sendmsg error");
+                }
+                else if (cqe->res < 0){
+                    errno = -cqe->res;
+                    perror("server: sendmsg error");
+                }
+                stats_request(&send->received);
+                freeSends[numFree++] = cqe->user_data;
+            }
+            else {
+                if (!(cqe->flags & IORING_CQE_F_MORE))
+                    armed = 0;
+                if (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED){
+                    errno = -cqe->res;
+                    perror("server: recvmsg error");
+                    exit(EXIT_FAILURE);
+                }
+                if (cqe->res >= 0 && (cqe->flags & IORING_CQE_F_BUFFER)){
+                    unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+                    char* buffer = uring_buffer(&ring, bid);
+
+                    if (numFree > 0){
+                        int i = freeSends[--numFree];
+                        uringRequest(&recvMsg, buffer, &sends[i], &received);
+                        sqe = uring_get_sqe(&ring);
+                        uring_prep_sendmsg(sqe, sockfd, &sends[i].msg, MSG_DONTWAIT);
+                        sqe->user_data = i;
+                    }
+                    else {
+                        /* every reply slot is in flight, this one is sent right away */
+                        uringRequest(&recvMsg, buffer, direct, &received);
+                        stats_add(&stats.syscalls, 1);
+                        if (sendmsg(sockfd, &direct->msg, 0) < 0)
+                            perror("server: sendmsg error");
+                        stats_request(&received);
+                    }
+                    uring_recycle_buffer(&ring, bid);
+                }
+            }
+            uring_cqe_seen(&ring);
         }
     }
+    uring_destroy(&ring);
+    free(sends);
+    return NULL;
 }
 
 /**
- * Auxiliar function called during thread create.
+ * Adds a socket to the epoll set of the connection backend.
+ * @param fd: socket
+ * @param ptr: session of the socket, NULL for the listening socket
 */
-void *applyCommands_aux(){
-    applyCommands();
+void addConnection(int fd, void* ptr){
+
+    struct epoll_event event;
+
+    event.events = EPOLLIN;
+    event.data.ptr = ptr;
+    stats_add(&stats.syscalls, 1);
+    if (epoll_ctl(connections_epfd, EPOLL_CTL_ADD, fd, &event) < 0){
+        perror("server: epoll_ctl error");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Accepts every pending connection and creates its session.
+*/
+void acceptConnections(){
+
+    int fd;
+    session* s;
+
+    while (1){
+        stats_add(&stats.syscalls, 1);
+        if ((fd = accept4(sockfd, NULL, NULL, SOCK_NONBLOCK)) < 0){
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && !serverStopping())
+                perror("server: accept error");
+            break;
+        }
+        if ((s = (session*) malloc(sizeof(session))) == NULL){
+            fprintf(stderr, "Error: session allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        s->fd = fd;
+        s->id = ++sessions;
+        s->requests = 0;
+        s->refs = 1;
+        addConnection(fd, s);
+    }
+}
+
+/**
+ * Receives up to SESSION_BURST requests of a connection into the request
+ * queue, so that other connections are not left waiting. The workers execute
+ * them in parallel and reply as each one completes, in any order.
+ * @param s: session of the connection
+ * @param req: buffer where each request is received
+*/
+void receiveSession(session* s, request* req){
+
+    int c;
+
+    for (int i = 0; i < SESSION_BURST; i++){
+        stats_add(&stats.syscalls, 1);
+        if ((c = recv(s->fd, req->input, sizeof(req->input)-1, 0)) <= 0){
+            if (c < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return;
+            /* the client closed the connection, replies still pending keep the session */
+            stats_add(&stats.syscalls, 1);
+            epoll_ctl(connections_epfd, EPOLL_CTL_DEL, s->fd, NULL);
+            releaseSession(s);
+            return;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &req->received);
+        req->input[c] = '\0';
+        req->length = c;
+        req->conn = s;
+        req->waiter = NULL;
+        s->requests++;
+        __atomic_add_fetch(&s->refs, 1, __ATOMIC_ACQ_REL);
+        admitRequest(req);
+    }
+}
+
+/**
+ * I/O thread of the connection backend: accepts connections and receives
+ * their requests into the request queue.
+*/
+void *receiveConnections(){
+
+    int n;
+    request req;
+    struct epoll_event events[SESSION_EVENTS];
+
+    while (!serverStopping()){
+        stats_add(&stats.syscalls, 1);
+        if ((n = epoll_wait(connections_epfd, events, SESSION_EVENTS, -1)) < 0){
+            if (errno == EINTR)
+                continue;
+            perror("server: epoll_wait error");
+            exit(EXIT_FAILURE);
+        }
+        stats_add(&stats.io_wakeups, 1);
+
+        for (int i = 0; i < n; i++){
+            if (events[i].data.ptr == NULL)
+                acceptConnections();
+            else
+                receiveSession((session*) events[i].data.ptr, &req);
+        }
+    }
     return NULL;
 }
 
+/**
+ * Prints how the server is used and exits.
+ * @param name: name of the executable
+*/
+void displayUsage(char* name){
+    fprintf(stderr, "Usage: %s [-a cpulist] [-b] [-c] [-f] [-i blocking|epoll|batch|seqpacket|uring] [-k batchsize] [-l leasems] [-Q read,mutate,bulk] [-L read,mutate,bulk] numthreads socketname\n", name);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * Parses a list of CPUs such as 0-3,8,10-11 into cpus.
+ * @param list: list of CPUs
+ * @return SUCCESS or FAIL if the list is invalid
+*/
+int parseCpuList(char* list){
+    int first, last, n;
+
+    numcpus = 0;
+    while (*list != '\0'){
+        if (sscanf(list, "%d%n", &first, &n) != 1)
+            return FAIL;
+        list += n;
+        last = first;
+        if (*list == '-'){
+            if (sscanf(list + 1, "%d%n", &last, &n) != 1)
+                return FAIL;
+            list += n + 1;
+        }
+        if (first < 0 || last < first || last >= CPU_SETSIZE)
+            return FAIL;
+        for (int cpu = first; cpu <= last && numcpus < CPU_SETSIZE; cpu++)
+            cpus[numcpus++] = cpu;
+        if (*list == ',')
+            list++;
+        else if (*list != '\0')
+            return FAIL;
+    }
+    return numcpus > 0 ? SUCCESS : FAIL;
+}
+
+/**
+ * Parses the options given before the arguments.
+ * -a: threads are pinned to the CPUs of a list (ex: 0-3,8), one after the
+ *     other, so that each one keeps its caches and its memory is allocated
+ *     on its NUMA node
+ * -b: top-level directories also use big-reader locks
+ * -c: creates and deletes in the same directory are combined
+ * -f: a lookup identical to one in flight waits for its result
+ * -i: how requests are received, every thread blocking in recvfrom (default)
+ *     or an epoll I/O thread feeding a queue of workers, or every thread
+ *     receiving and replying to many requests per syscall (batch), or
+ *     clients connecting to a SOCK_SEQPACKET socket (seqpacket), or every
+ *     thread driving its own io_uring (uring), replaced by the blocking
+ *     backend if the kernel does not support it
+ * -k: maximum number of requests per syscall of the batched backend
+ * -l: milliseconds the leases granted on lookups last, which clients use to
+ *     answer lookups from their cache (none by default)
+ * -Q: requests each priority class queues before rejecting new ones (epoll
+ *     and seqpacket backends)
+ * -L: requests of each priority class executed at the same time
+ * @param argc: number of arguments given by user
+ * @param argv: array from stdin given by user
+*/
+void parseOptions(int argc, char* argv[]){
+    int opt;
+
+    while ((opt = getopt(argc, argv, "a:bcfi:k:l:Q:L:")) != -1){
+        switch (opt) {
+            case 'a':
+                if (parseCpuList(optarg) == FAIL)
+                    displayUsage(argv[0]);
+                break;
+            case 'b':
+                big_reader_dirs = 1;
+                break;
+            case 'c':
+                combining_dirs = 1;
+                break;
+            case 'f':
+                single_flight = 1;
+                break;
+            case 'i':
+                if (!strcmp(optarg, "blocking"))
+                    backend = IO_BLOCKING;
+                else if (!strcmp(optarg, "epoll"))
+                    backend = IO_EPOLL;
+                else if (!strcmp(optarg, "batch"))
+                    backend = IO_BATCH;
+                else if (!strcmp(optarg, "seqpacket"))
+                    backend = IO_CONNECTION;
+                else if (!strcmp(optarg, "uring"))
+                    backend = IO_URING;
+                else
+                    displayUsage(argv[0]);
+                break;
+            case 'k':
+                batch_size = atoi(optarg);
+                if (batch_size <= 0 || batch_size > MAX_BATCH_SIZE)
+                    displayUsage(argv[0]);
+                break;
+            case 'l':
+                lease_ms = atol(optarg);
+                if (lease_ms <= 0)
+                    displayUsage(argv[0]);
+                break;
+            case 'Q':
+                if (sscanf(optarg, "%d,%d,%d", &class_bounds[CLASS_READ], &class_bounds[CLASS_MUTATE],
+                        &class_bounds[CLASS_BULK]) != NUM_CLASSES)
+                    displayUsage(argv[0]);
+                for (int c = 0; c < NUM_CLASSES; c++)
+                    if (class_bounds[c] <= 0)
+                        displayUsage(argv[0]);
+                break;
+            case 'L':
+                if (sscanf(optarg, "%d,%d,%d", &class_limits[CLASS_READ], &class_limits[CLASS_MUTATE],
+                        &class_limits[CLASS_BULK]) != NUM_CLASSES)
+                    displayUsage(argv[0]);
+                for (int c = 0; c < NUM_CLASSES; c++)
+                    if (class_limits[c] <= 0)
+                        displayUsage(argv[0]);
+                break;
+            default:
+                displayUsage(argv[0]);
+        }
+    }
+}
+
 /**
  * Verifies the validity of the arguments given as input.
  * @param argc: number of arguments given by user
  * @param argv: array from stdin given by user
 */
 void verifyInput(int argc, char* argv[]){
-    if (argc != 3){
+    if (argc - optind != 2){
         fprintf(stderr, "Error: invalid number of arguments\n");
         exit(EXIT_FAILURE);
     }
-    /* argv[1] refers to the number of threads */
-    if (atoi(argv[1]) <= 0){
+    /* argv[optind] refers to the number of threads */
+    if (atoi(argv[optind]) <= 0){
         fprintf(stderr, "Error: invalid number of threads\n");
         exit(EXIT_FAILURE);
     }
 }
 
 /**
- * Creates pool of threads.
+ * Creates pool of threads. With -a each thread starts already pinned to the
+ * next CPU of the list: the buffers it allocates and touches first, such as
+ * its stack and the request buffers of each backend, are placed by the
+ * kernel on the NUMA node of that CPU.
  * @param tid: array of thread id's
  * @param numthreads: number of threads
  * @param function: function to execute
 */
 void threadCreate(pthread_t* tid, int numthreads, void* function){
+    pthread_attr_t attr;
+    cpu_set_t cpuset;
+
+    pthread_attr_init(&attr);
     for(int i = 0; i < numthreads; i++){
-        if(pthread_create(&tid[i], NULL, function, NULL) != 0){
-            fprintf(stderr, "Error: creating threads\n");
+        if (numcpus > 0){
+            CPU_ZERO(&cpuset);
+            CPU_SET(cpus[threads_created++ % numcpus], &cpuset);
+            pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpuset);
+        }
+        int err = pthread_create(&tid[i], &attr, function, NULL);
+        if(err != 0){
+            fprintf(stderr, "Error: creating threads: %s\n", strerror(err));
             exit(EXIT_FAILURE);
         }
     }
+    pthread_attr_destroy(&attr);
 }
 
 /**
@@ -160,6 +1071,25 @@ void threadJoin(pthread_t* tid, int numthreads){
     }
 }
 
+/**
+ * Waits for signals: SIGUSR1 prints the statistics, SIGINT and SIGTERM print
+ * them and return so that the server terminates.
+ * @param signals: signals blocked in every thread
+*/
+void waitSignals(sigset_t* signals){
+    int sig;
+
+    while (1){
+        if (sigwait(signals, &sig) != 0){
+            fprintf(stderr, "Error: sigwait error\n");
+            exit(EXIT_FAILURE);
+        }
+        stats_print(stderr);
+        if (sig != SIGUSR1)
+            return;
+    }
+}
+
 /**
  * Resets and set socket address.
  * @param path: socket name
@@ -189,8 +1119,8 @@ void initSocket(char* socket_name){
     socklen_t addrlen;
     struct sockaddr_un server_addr;
 
-    /* creates a socket of domain UNIX and type DATAGRAM */
-    if ((sockfd = socket(AF_UNIX,SOCK_DGRAM,0)) < 0){
+    /* creates a socket of domain UNIX and type DATAGRAM, or SEQPACKET for connections */
+    if ((sockfd = socket(AF_UNIX, backend == IO_CONNECTION ? SOCK_SEQPACKET | SOCK_NONBLOCK : SOCK_DGRAM, 0)) < 0){
         perror("server:can't open socket");
         exit(EXIT_FAILURE);
     }
@@ -207,37 +1137,114 @@ void initSocket(char* socket_name){
         perror("server: bind error");
         exit(EXIT_FAILURE);
     }
+
+    if (backend == IO_CONNECTION && listen(sockfd, SOMAXCONN) < 0){
+        perror("server: listen error");
+        exit(EXIT_FAILURE);
+    }
 }
 
 int main(int argc, char* argv[]) {
 
-    int numthreads = atoi(argv[1]);
-
-    /* Verifies given input */
+    /* Parses options and verifies given input */
+    parseOptions(argc, argv);
     verifyInput(argc, argv);
 
+    int numthreads = atoi(argv[optind]);
+    char* socket_name = argv[optind + 1];
+
     /* Init filesystem and locks */
     init_fs();
+    flight_init();
+    lease_init(lease_ms * 1000);
+
+    /* Older kernels, or io_uring disabled by a sysctl or seccomp, fall back to recvfrom */
+    if (backend == IO_URING && uring_probe() == FAIL){
+        fprintf(stderr, "Warning: io_uring is not available (%s), using the blocking backend\n", strerror(errno));
+        backend = IO_BLOCKING;
+    }
 
     /* Init server socket */
-    initSocket(argv[2]);
+    initSocket(socket_name);
+
+    /* Signals are only handled by the initial thread */
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    stats_init();
 
     /* Creates array of thread id's */
-    pthread_t* tid = (pthread_t*) malloc(sizeof(pthread_t) * numthreads);
+    pthread_t* tid = (pthread_t*) malloc(sizeof(pthread_t) * (numthreads + 1));
 
-    /* Creates pool of threads to execute the commands inside the buffer */
-    threadCreate(tid,numthreads,applyCommands_aux);
+    /* A class without a limit may use every thread */
+    for (int c = 0; c < NUM_CLASSES; c++)
+        if (class_limits[c] == 0 || class_limits[c] > numthreads)
+            class_limits[c] = numthreads;
 
-    /* Joins threads */
-    threadJoin(tid,numthreads);
+    /* Creates pool of threads to execute the commands received */
+    if (backend == IO_EPOLL){
+        queue_init(&requests, class_bounds, class_limits);
+        threadCreate(tid, numthreads, workCommands);
+        threadCreate(tid + numthreads, 1, receiveCommands);
+    }
+    else if (backend == IO_BATCH)
+        threadCreate(tid, numthreads, batchCommands);
+    else if (backend == IO_URING){
+        if ((stop_fd = eventfd(0, 0)) < 0){
+            perror("server: eventfd error");
+            exit(EXIT_FAILURE);
+        }
+        threadCreate(tid, numthreads, uringCommands);
+    }
+    else if (backend == IO_CONNECTION){
+        if ((connections_epfd = epoll_create1(0)) < 0){
+            perror("server: epoll_create error");
+            exit(EXIT_FAILURE);
+        }
+        queue_init(&requests, class_bounds, class_limits);
+        addConnection(sockfd, NULL);
+        threadCreate(tid, numthreads, workCommands);
+        threadCreate(tid + numthreads, 1, receiveConnections);
+    }
+    else
+        threadCreate(tid,numthreads,applyCommands_aux);
+
+    /* Runs until SIGINT or SIGTERM */
+    waitSignals(&signals);
+
+    /* Stops receiving requests, the threads blocked on the socket return */
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    shutdown(sockfd, SHUT_RD);
+    if (stop_fd >= 0 && eventfd_write(stop_fd, 1) < 0)
+        perror("server: eventfd write error");
+
+    /* Joins threads, the requests already received are answered first */
+    if (backend == IO_EPOLL || backend == IO_CONNECTION){
+        threadJoin(tid + numthreads, 1);
+        shm_close_sessions();
+        queue_close(&requests);
+        threadJoin(tid, numthreads);
+        queue_destroy(&requests);
+        if (backend == IO_CONNECTION)
+            close(connections_epfd);
+    }
+    else {
+        threadJoin(tid, numthreads);
+        shm_close_sessions();
+    }
 
-    /* Release allocated memory and destroys locks */
+    /* Release allocated memory and destroys locks, the deleted i-nodes are released first */
     free(tid);
     destroy_fs();
 
     /* Closes and unlinks socket */
+    if (stop_fd >= 0)
+        close(stop_fd);
     close(sockfd);
-    unlink(argv[1]);
+    unlink(socket_name);
 
     exit(EXIT_SUCCESS);
 }
@@ -0,0 +1,395 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "protocol.h"
+
+/* conversion that reads a path of the text format, at most MAX_FILE_NAME - 1 characters */
+#define PATH_FORMAT "%99s"
+
+/**
+ * Checks that a path read with PATH_FORMAT was not cut, a longer path is
+ * rejected instead of being parsed as a different one.
+ * @param input: string scanned
+ * @param end: offset of the end of the path (%n), or -1 if it was not read
+ * @return SUCCESS or FAIL
+*/
+static int checkPathEnd(char *input, int end) {
+	if (end < 0 || input[end] == '\0' || isspace((unsigned char) input[end]))
+		return SUCCESS;
+	return FAIL;
+}
+
+/**
+ * Parses a request of the binary format, pointing the paths into the message.
+ * @param msg: start of the request
+ * @param available: bytes from msg until the end of the message
+ * @param req: where the request is parsed to
+ * @param used: set to the size of the request
+ * @return SUCCESS or FAIL if the request is malformed
+*/
+static int parseBinary(char *msg, uint32_t available, parsed_request *req, uint32_t *used) {
+	tfs_header header;
+	char *paths[2] = { NULL, NULL };
+	uint32_t offset = 0;
+	int numPaths;
+
+	/* the header of an operation inside a transaction may not be aligned */
+	if (available < sizeof(tfs_header))
+		return FAIL;
+	memcpy(&header, msg, sizeof(tfs_header));
+	if (header.magic != TFS_MAGIC || header.version != TFS_VERSION ||
+			header.size > available - sizeof(tfs_header))
+		return FAIL;
+
+	switch (header.opcode) {
+		case TFS_OP_CREATE: req->token = 'c'; numPaths = 1; break;
+		case TFS_OP_DELETE: req->token = 'd'; numPaths = 1; break;
+		case TFS_OP_LOOKUP: req->token = 'l'; numPaths = 1; break;
+		case TFS_OP_MOVE: req->token = 'm'; numPaths = 2; break;
+		case TFS_OP_PRINT: req->token = 'p'; numPaths = 1; break;
+		case TFS_OP_TRANSACTION: req->token = 't'; numPaths = 0; break;
+		case TFS_OP_MOUNT: req->token = 's'; numPaths = 1; break;
+		case TFS_OP_BATCH: req->token = 'b'; numPaths = 0; break;
+		case TFS_OP_READDIR: req->token = 'r'; numPaths = 1; break;
+		case TFS_OP_STAT: req->token = 'a'; numPaths = 1; break;
+		default: return FAIL;
+	}
+
+	char *payload = msg + sizeof(tfs_header);
+	for (int i = 0; i < numPaths; i++) {
+		uint32_t len = header.length[i];
+		if (len == 0 || len >= MAX_FILE_NAME || offset + len >= header.size || payload[offset + len] != '\0')
+			return FAIL;
+		paths[i] = payload + offset;
+		offset += len + 1;
+	}
+
+	/* the id of the client follows the paths */
+	req->owner = 0;
+	if (numPaths > 0 && header.flags & TFS_FLAG_LEASE) {
+		if (offset + sizeof(uint32_t) > header.size)
+			return FAIL;
+		memcpy(&req->owner, payload + offset, sizeof(uint32_t));
+		offset += sizeof(uint32_t);
+	}
+
+	if (req->token == 'r') {
+		tfs_readdir_args args;
+
+		if (offset + sizeof(args) > header.size)
+			return FAIL;
+		memcpy(&args, payload + offset, sizeof(args));
+		offset += sizeof(args);
+		req->cursor = args.cursor;
+		req->count = args.count < TFS_READDIR_MAX_ENTRIES ? args.count : TFS_READDIR_MAX_ENTRIES;
+	}
+
+	if (req->token == 't' || req->token == 'b') {
+		if (header.length[0] == 0 || header.length[0] > MAX_TRANSACTION_OPS)
+			return FAIL;
+		req->ops = payload;
+		req->opsSize = header.size;
+		req->numOps = header.length[0];
+	}
+	else if (offset != header.size)
+		return FAIL;
+
+	req->binary = 1;
+	req->opcode = header.opcode;
+	req->request_id = header.request_id;
+	req->lease = req->token == 'l' && header.flags & TFS_FLAG_LEASE;
+	req->nodeType = header.flags & TFS_FLAG_DIRECTORY ? T_DIRECTORY : T_FILE;
+	req->path = paths[0];
+	req->dest = paths[1];
+	*used = sizeof(tfs_header) + header.size;
+	return SUCCESS;
+}
+
+/**
+ * Parses a request of the text format ("c /a f", "m /a /b", ...), except for
+ * transactions, whose operations are parsed by parseTransaction.
+ * @param input: request ended by '\0'
+ * @param req: where the request is parsed to
+ * @return SUCCESS or FAIL if the request is malformed
+*/
+static int parseText(char *input, parsed_request *req) {
+	int numTokens, pathEnd = -1, destEnd = -1;
+	char type;
+
+	req->binary = 0;
+	req->owner = 0;
+	req->lease = 0;
+	req->token = input[0];
+	if (req->token == 't')
+		return SUCCESS;
+	/* a page of entries or the attributes of a node only fit the binary format */
+	if (req->token == 'r' || req->token == 'a')
+		return FAIL;
+
+	req->path = req->pathBuffer;
+	req->dest = req->destBuffer;
+	if (req->token == 'm')
+		numTokens = sscanf(input, "%c " PATH_FORMAT "%n " PATH_FORMAT "%n", &req->token, req->pathBuffer, &pathEnd, req->destBuffer, &destEnd); // different sscanf for move command
+	else
+		numTokens = sscanf(input, "%c " PATH_FORMAT "%n %c", &req->token, req->pathBuffer, &pathEnd, &type);
+
+	if (numTokens < 2 || checkPathEnd(input, pathEnd) == FAIL || checkPathEnd(input, destEnd) == FAIL)
+		return FAIL;
+	if (req->token == 'c') {
+		if (numTokens != 3 || (type != 'f' && type != 'd'))
+			return FAIL;
+		req->nodeType = type == 'f' ? T_FILE : T_DIRECTORY;
+	}
+	return SUCCESS;
+}
+
+/**
+ * Parses a request of either format.
+ * @param input: message received, followed by a '\0'
+ * @param length: size of the message
+ * @param req: where the request is parsed to
+ * @return SUCCESS or FAIL if the request is malformed
+*/
+int parseRequest(char *input, int length, parsed_request *req) {
+	uint32_t used;
+
+	req->input = input;
+	req->lease = 0;
+	if ((unsigned char) input[0] != TFS_MAGIC)
+		return parseText(input, req);
+
+	/* a malformed request still gets a reply with its id */
+	tfs_header header = { 0 };
+	if (length >= sizeof(tfs_header))
+		memcpy(&header, input, sizeof(tfs_header));
+	req->binary = 1;
+	req->opcode = header.opcode;
+	req->request_id = header.request_id;
+
+	if (parseBinary(input, length, req, &used) == FAIL || used != length) {
+		req->lease = 0;
+		return FAIL;
+	}
+	return SUCCESS;
+}
+
+/**
+ * Parses the operations of a text transaction.
+ * The first line is the header ("t <number of operations>") and each of the
+ * following lines is a create, delete or move command.
+ * @param input: transaction message
+ * @param ops: array where the operations are stored
+ * @return number of operations or FAIL
+*/
+int parseTransaction(char* input, tx_op* ops){
+
+    int numOps, numTokens;
+    char *saveptr;
+    char token, arg1[MAX_INPUT_SIZE], arg2[MAX_INPUT_SIZE];
+
+    char *line = strtok_r(input, "\n", &saveptr);
+    if (line == NULL || sscanf(line, "t %d", &numOps) != 1 || numOps <= 0 || numOps > MAX_TRANSACTION_OPS)
+        return FAIL;
+
+    for (int i = 0; i < numOps; i++) {
+        if ((line = strtok_r(NULL, "\n", &saveptr)) == NULL)
+            return FAIL;
+
+        int end1 = -1, end2 = -1;
+
+        numTokens = sscanf(line, "%c " PATH_FORMAT "%n " PATH_FORMAT "%n", &token, arg1, &end1, arg2, &end2);
+        if (checkPathEnd(line, end1) == FAIL || checkPathEnd(line, end2) == FAIL)
+            return FAIL;
+        ops[i].token = token;
+
+        switch (token) {
+            case 'c':
+                if (numTokens != 3 || (arg2[0] != 'f' && arg2[0] != 'd'))
+                    return FAIL;
+                strcpy(ops[i].path, arg1);
+                ops[i].nodeType = arg2[0] == 'f' ? T_FILE : T_DIRECTORY;
+                break;
+            case 'd':
+                if (numTokens != 2)
+                    return FAIL;
+                strcpy(ops[i].path, arg1);
+                break;
+            case 'm':
+                if (numTokens != 3)
+                    return FAIL;
+                strcpy(ops[i].path, arg1);
+                strcpy(ops[i].dest, arg2);
+                break;
+            default:
+                return FAIL;
+        }
+    }
+    return numOps;
+}
+
+/**
+ * Parses the operations of a transaction of either format.
+ * @param req: parsed transaction
+ * @param ops: array where the operations are stored
+ * @return number of operations or FAIL
+*/
+int parseTransactionOps(parsed_request *req, tx_op *ops) {
+	parsed_request op;
+	uint32_t offset = 0, used;
+
+	if (!req->binary)
+		return parseTransaction(req->input, ops);
+
+	for (int i = 0; i < req->numOps; i++) {
+		if (parseBinary(req->ops + offset, req->opsSize - offset, &op, &used) == FAIL ||
+				(op.token != 'c' && op.token != 'd' && op.token != 'm'))
+			return FAIL;
+		/* every operation comes from the same client */
+		req->owner = op.owner;
+		ops[i].token = op.token;
+		ops[i].nodeType = op.nodeType;
+		strcpy(ops[i].path, op.path);
+		if (op.token == 'm')
+			strcpy(ops[i].dest, op.dest);
+		offset += used;
+	}
+	return offset == req->opsSize ? req->numOps : FAIL;
+}
+
+/**
+ * Parses the next operation of a binary batch, which may be a create,
+ * delete, lookup or move.
+ * @param req: parsed batch
+ * @param offset: offset of the operation inside the batch, advanced past it
+ * @param op: where the operation is parsed to, its paths point into the batch
+ * @return SUCCESS or FAIL if the operation is malformed
+*/
+int parseBatchOp(parsed_request *req, uint32_t *offset, parsed_request *op) {
+	uint32_t used;
+
+	if (*offset >= req->opsSize || parseBinary(req->ops + *offset, req->opsSize - *offset, op, &used) == FAIL ||
+			(op->token != 'c' && op->token != 'd' && op->token != 'l' && op->token != 'm'))
+		return FAIL;
+	*offset += used;
+	return SUCCESS;
+}
+
+/**
+ * Builds the reply to a readdir that was executed, with as many of its
+ * entries as fit. If some are left out, the cursor resumes the listing at
+ * the first of them.
+ * @param req: parsed readdir, with its entries and the cursor of the next page
+ * @param count: number of entries
+ * @param reply: buffer with at least TFS_MAX_REPLY_SIZE bytes, whose header
+ * 	is already built
+ * @return size of the reply
+*/
+static int buildReaddirReply(parsed_request *req, int count, char *reply) {
+	tfs_readdir_reply header;
+	uint32_t size = sizeof(tfs_readdir_reply);
+	int sent;
+
+	memcpy(&header, reply, sizeof(tfs_reply));
+	header.cursor = req->cursor;
+	for (sent = 0; sent < count; sent++) {
+		dir_listing *entry = &req->listing[sent];
+		tfs_dirent dirent = { entry->inumber, entry->nodeType, strlen(entry->name) };
+
+		if (size + sizeof(dirent) + dirent.length + 1 > TFS_MAX_REPLY_SIZE) {
+			header.cursor = req->listing[sent - 1].next;
+			break;
+		}
+		memcpy(reply + size, &dirent, sizeof(dirent));
+		memcpy(reply + size + sizeof(dirent), entry->name, dirent.length + 1);
+		size += sizeof(dirent) + dirent.length + 1;
+	}
+	header.reply.result = sent;
+	memcpy(reply, &header, sizeof(header));
+	return size;
+}
+
+/**
+ * Builds the reply to a request: the result alone for the text format, or a
+ * reply carrying the request id for the binary format. The reply to a batch
+ * that was executed carries the result of each operation, the reply to a
+ * lookup granted a lease its duration, the reply to a readdir its entries
+ * and the reply to a stat the attributes of the node.
+ * @param req: parsed request
+ * @param result: result of the operation
+ * @param reply: buffer with at least TFS_MAX_REPLY_SIZE bytes
+ * @return size of the reply
+*/
+int buildReply(parsed_request *req, int result, char *reply) {
+	tfs_reply binary;
+
+	if (!req->binary) {
+		memcpy(reply, &result, sizeof(result));
+		return sizeof(result);
+	}
+	binary.magic = TFS_MAGIC;
+	binary.version = TFS_VERSION;
+	binary.opcode = req->opcode;
+	binary.flags = req->lease > 0 ? TFS_FLAG_LEASE : 0;
+	binary.request_id = req->request_id;
+	binary.result = result;
+	memcpy(reply, &binary, sizeof(binary));
+	if (req->lease > 0) {
+		memcpy(reply + sizeof(binary), &req->lease, sizeof(uint32_t));
+		return sizeof(tfs_lease_reply);
+	}
+	if (req->opcode == TFS_OP_BATCH && result > 0) {
+		memcpy(reply + sizeof(binary), req->results, result * sizeof(int32_t));
+		return sizeof(binary) + result * sizeof(int32_t);
+	}
+	if (req->opcode == TFS_OP_READDIR && result >= 0)
+		return buildReaddirReply(req, result, reply);
+	if (req->opcode == TFS_OP_STAT && result >= 0) {
+		tfs_stat_reply stat = { binary, req->st.nodeType, req->st.size, req->st.generation };
+
+		memcpy(reply, &stat, sizeof(stat));
+		return sizeof(stat);
+	}
+	return sizeof(binary);
+}
+
+/**
+ * Finds the operation of a request without parsing it.
+ * @param input: message received, followed by a '\0'
+ * @param length: size of the message
+ * @return letter of the operation in the text format, '\0' if unknown
+*/
+char requestToken(char *input, int length) {
+	static const char tokens[] = { '\0', 'c', 'd', 'l', 'm', 'p', 't', 's', 'b', 'r', 'a' };
+	tfs_header header;
+
+	if ((unsigned char) input[0] != TFS_MAGIC)
+		return input[0];
+	if (length < sizeof(tfs_header))
+		return '\0';
+	memcpy(&header, input, sizeof(tfs_header));
+	return header.opcode < sizeof(tokens) ? tokens[header.opcode] : '\0';
+}
+
+/**
+ * Builds the reply to a request that is not executed.
+ * @param input: message received, followed by a '\0'
+ * @param length: size of the message
+ * @param error: error code sent as the result
+ * @param reply: buffer with at least TFS_MAX_REPLY_SIZE bytes
+ * @return size of the reply
+*/
+int buildErrorReply(char *input, int length, int error, char *reply) {
+	parsed_request req;
+	tfs_header header = { 0 };
+
+	req.binary = (unsigned char) input[0] == TFS_MAGIC;
+	if (req.binary && length >= sizeof(tfs_header))
+		memcpy(&header, input, sizeof(tfs_header));
+	req.opcode = header.opcode;
+	req.request_id = header.request_id;
+	req.results = NULL;
+	req.listing = NULL;
+	req.lease = 0;
+	return buildReply(&req, error, reply);
+}
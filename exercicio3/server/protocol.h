@@ -0,0 +1,43 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+#include "fs/operations.h"
+#include "tecnicofs-protocol.h"
+
+/*
+ * Request parsed from either format. Binary requests point into the message
+ * received, text requests are copied into the buffers.
+ */
+typedef struct parsed_request {
+	char token;                 /* letter of the text format: c, l, d, m, p, t, s (mount), b (batch), r (readdir) or a (stat) */
+	type nodeType;              /* only used by create */
+	char *path;
+	char *dest;                 /* only used by move */
+	int binary;
+	uint8_t opcode;             /* only used by the binary format */
+	uint32_t request_id;
+	char *input;                /* message received */
+	char *ops;                  /* operations of a binary transaction or batch */
+	uint32_t opsSize;
+	int numOps;
+	int32_t *results;           /* results of the operations of a batch, set by the caller */
+	uint32_t owner;             /* client that sent it (TFS_FLAG_LEASE), 0 if unknown */
+	uint32_t lease;             /* set if a lookup asks for a lease, then microseconds granted or 0 */
+	uint32_t cursor;            /* readdir: cursor of the page, then of the next page */
+	uint32_t count;             /* readdir: entries wanted */
+	dir_listing *listing;       /* entries of a readdir, set by the caller */
+	node_stat st;               /* attributes found by a stat */
+	char pathBuffer[MAX_INPUT_SIZE];
+	char destBuffer[MAX_INPUT_SIZE];
+} parsed_request;
+
+int parseRequest(char *input, int length, parsed_request *req);
+int parseTransaction(char *input, tx_op *ops);
+int parseTransactionOps(parsed_request *req, tx_op *ops);
+int parseBatchOp(parsed_request *req, uint32_t *offset, parsed_request *op);
+int buildReply(parsed_request *req, int result, char *reply);
+char requestToken(char *input, int length);
+int buildErrorReply(char *input, int length, int error, char *reply);
+
+#endif /* PROTOCOL_H */
@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "queue.h"
+#include "stats.h"
+#include "fs/state.h"
+
+char *class_names[NUM_CLASSES] = { "read", "mutate", "bulk" };
+
+/**
+ * Initializes an empty queue.
+ * @param queue: queue to initialize
+ * @param bounds: requests each class holds before rejecting
+ * @param limits: requests of each class executed at the same time
+*/
+void queue_init(request_queue *queue, int bounds[], int limits[]) {
+	for (int c = 0; c < NUM_CLASSES; c++) {
+		class_queue *cq = &queue->classes[c];
+		cq->bound = bounds[c];
+		cq->limit = limits[c];
+		cq->counter = 0;
+		cq->running = 0;
+		cq->insertPointer = 0;
+		cq->removePointer = 0;
+		if ((cq->slots = (request *) malloc(sizeof(request) * cq->bound)) == NULL) {
+			fprintf(stderr, "Error: queue allocation error\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (pthread_mutex_init(&queue->mutex, NULL) != 0 ||
+			pthread_cond_init(&queue->canRemove, NULL) != 0) {
+		fprintf(stderr, "Error: queue init error\n");
+		exit(EXIT_FAILURE);
+	}
+	queue->closed = 0;
+}
+
+/**
+ * Destroys the locks and buffers of a queue.
+ * @param queue: queue to destroy
+*/
+void queue_destroy(request_queue *queue) {
+	for (int c = 0; c < NUM_CLASSES; c++)
+		free(queue->classes[c].slots);
+	pthread_mutex_destroy(&queue->mutex);
+	pthread_cond_destroy(&queue->canRemove);
+}
+
+static void queue_lock(request_queue *queue) {
+	if (pthread_mutex_lock(&queue->mutex) != 0) {
+		fprintf(stderr, "Error: mutex lock error\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void queue_unlock(request_queue *queue) {
+	if (pthread_mutex_unlock(&queue->mutex) != 0) {
+		fprintf(stderr, "Error: mutex unlock error\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * Copies a request to the queue of its class, unless that queue is full.
+ * @param queue: queue
+ * @param req: request received
+ * @param class: class of the request
+ * @return SUCCESS or FAIL if the request must be rejected
+*/
+int queue_insert(request_queue *queue, request *req, request_class class) {
+	class_queue *cq = &queue->classes[class];
+	request *slot;
+
+	queue_lock(queue);
+	if (cq->counter == cq->bound) {
+		queue_unlock(queue);
+		stats_add(&stats.rejected[class], 1);
+		return FAIL;
+	}
+	slot = &cq->slots[cq->insertPointer];
+	/* only the bytes received are copied */
+	memcpy(slot->input, req->input, req->length + 1);
+	slot->length = req->length;
+	slot->client_addr = req->client_addr;
+	slot->addrlen = req->addrlen;
+	slot->received = req->received;
+	slot->conn = req->conn;
+	slot->waiter = req->waiter;
+	cq->insertPointer = (cq->insertPointer + 1) % cq->bound;
+	cq->counter++;
+	pthread_cond_signal(&queue->canRemove);
+	queue_unlock(queue);
+	return SUCCESS;
+}
+
+/**
+ * Finds the most urgent class with requests that is under its limit.
+ * @param queue: queue, locked
+ * @return class or NUM_CLASSES if there is none
+*/
+static request_class queue_next(request_queue *queue) {
+	for (int c = 0; c < NUM_CLASSES; c++) {
+		class_queue *cq = &queue->classes[c];
+		if (cq->counter > 0 && cq->running < cq->limit)
+			return c;
+	}
+	return NUM_CLASSES;
+}
+
+/**
+ * Removes the next request to execute, waiting if there is none.
+ * The worker must call queue_done once the request is executed.
+ * @param queue: queue
+ * @param req: where the request is copied to
+ * @return class of the request, or NUM_CLASSES once the queue is closed and empty
+*/
+request_class queue_remove(request_queue *queue, request *req) {
+	request_class class;
+	class_queue *cq;
+	request *slot;
+
+	queue_lock(queue);
+	while ((class = queue_next(queue)) == NUM_CLASSES) {
+		if (queue->closed) {
+			queue_unlock(queue);
+			return NUM_CLASSES;
+		}
+		pthread_cond_wait(&queue->canRemove, &queue->mutex);
+		stats_add(&stats.worker_wakeups, 1);
+	}
+	cq = &queue->classes[class];
+	slot = &cq->slots[cq->removePointer];
+	memcpy(req->input, slot->input, slot->length + 1);
+	req->length = slot->length;
+	req->client_addr = slot->client_addr;
+	req->addrlen = slot->addrlen;
+	req->received = slot->received;
+	req->conn = slot->conn;
+	req->waiter = slot->waiter;
+	cq->removePointer = (cq->removePointer + 1) % cq->bound;
+	cq->counter--;
+	cq->running++;
+	queue_unlock(queue);
+	return class;
+}
+
+/**
+ * Accounts for the end of a request, letting another one of its class run.
+ * @param queue: queue
+ * @param class: class of the request
+*/
+void queue_done(request_queue *queue, request_class class) {
+	queue_lock(queue);
+	class_queue *cq = &queue->classes[class];
+	/* a worker may be waiting for the class to go under its limit */
+	if (cq->running-- == cq->limit && cq->counter > 0)
+		pthread_cond_signal(&queue->canRemove);
+	queue_unlock(queue);
+}
+
+/**
+ * Closes a queue: the workers execute the requests still inside it and then
+ * queue_remove returns NUM_CLASSES.
+ * @param queue: queue
+*/
+void queue_close(request_queue *queue) {
+	queue_lock(queue);
+	queue->closed = 1;
+	pthread_cond_broadcast(&queue->canRemove);
+	queue_unlock(queue);
+}
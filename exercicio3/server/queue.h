@@ -0,0 +1,64 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "tecnicofs-api-constants.h"
+
+#define QUEUE_SIZE 256     /* default bound of the read and mutate classes */
+#define BULK_QUEUE_SIZE 8  /* default bound of the bulk class */
+
+/*
+ * Priority classes, from the most to the least urgent
+ */
+typedef enum request_class { CLASS_READ, CLASS_MUTATE, CLASS_BULK, NUM_CLASSES } request_class;
+
+/*
+ * Request received by the I/O thread, waiting for a worker
+ */
+typedef struct request {
+	char input[MAX_MESSAGE_SIZE];
+	int length;
+	struct sockaddr_un client_addr;
+	socklen_t addrlen;
+	struct timespec received;
+	void *conn;             /* connection the reply goes to, NULL for datagrams */
+	void *waiter;           /* shared memory session waiting for the reply, or NULL */
+} request;
+
+/*
+ * Circular buffer of the requests of a class
+ */
+typedef struct class_queue {
+	request *slots;
+	int bound;              /* requests the queue holds before rejecting */
+	int limit;              /* requests of the class executed at the same time */
+	int counter;            /* number of requests inside the queue */
+	int running;            /* requests being executed */
+	int insertPointer;      /* next free slot */
+	int removePointer;      /* next request to be removed */
+} class_queue;
+
+/*
+ * Queue with a circular buffer per class. Workers take the request of the
+ * most urgent class that has not reached its concurrency limit.
+ */
+typedef struct request_queue {
+	class_queue classes[NUM_CLASSES];
+	pthread_mutex_t mutex;
+	pthread_cond_t canRemove;
+	int closed;             /* set once no request will be inserted */
+} request_queue;
+
+extern char *class_names[NUM_CLASSES];
+
+void queue_init(request_queue *queue, int bounds[], int limits[]);
+void queue_destroy(request_queue *queue);
+int queue_insert(request_queue *queue, request *req, request_class class);
+request_class queue_remove(request_queue *queue, request *req);
+void queue_done(request_queue *queue, request_class class);
+void queue_close(request_queue *queue);
+
+#endif /* QUEUE_H */
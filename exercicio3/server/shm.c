@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shm.h"
+#include "fs/state.h"
+
+/*
+ * Shared memory session served by its own thread
+ */
+typedef struct shm_session {
+	shm_segment *segment;
+	shm_handler handler;
+	request req;            /* request being executed, out of reach of the client */
+} shm_session;
+
+int shm_sessions = 0;
+int shm_closing = 0;                    /* set when the server stops */
+pthread_mutex_t shm_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t shm_ended = PTHREAD_COND_INITIALIZER;
+
+/**
+ * Checks whether the client of a session is gone.
+ * @param segment: segment of the session
+*/
+static int shm_client_gone(shm_segment *segment) {
+	return __atomic_load_n(&segment->closed, __ATOMIC_SEQ_CST) ||
+		(kill(segment->client_pid, 0) < 0 && errno == ESRCH);
+}
+
+/**
+ * Accounts for the end of a session, waking shm_close_sessions after the last one.
+*/
+static void shm_session_end() {
+	pthread_mutex_lock(&shm_mutex);
+	if (__atomic_sub_fetch(&shm_sessions, 1, __ATOMIC_SEQ_CST) == 0)
+		pthread_cond_broadcast(&shm_ended);
+	pthread_mutex_unlock(&shm_mutex);
+}
+
+/**
+ * Serves the requests of a session until the client unmounts or terminates.
+ * @param arg: session
+*/
+static void *shm_session_loop(void *arg) {
+	shm_session *session = (shm_session *) arg;
+	shm_segment *segment = session->segment;
+	request *req = &session->req;
+	struct timespec timeout = { 1, 0 };
+	int spin = shm_spin();
+	sigset_t signals;
+
+	/* signals are handled by the initial thread only */
+	sigfillset(&signals);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+	while (1) {
+		if (__atomic_load_n(&shm_closing, __ATOMIC_SEQ_CST))
+			break;
+		if (!shm_wait(&segment->requests, spin, &timeout)) {
+			if (shm_client_gone(segment))
+				break;
+			continue;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &req->received);
+
+		/* the client can still write the slot, the request is copied before being parsed */
+		uint32_t head = segment->requests.head.value;
+		shm_slot *slot = &segment->request[head % SHM_RING_SLOTS];
+		uint32_t size = __atomic_load_n(&slot->size, __ATOMIC_RELAXED);
+		char reply[TFS_MAX_REPLY_SIZE];
+		int replySize = sizeof(tfs_reply);
+
+		if (size > MAX_MESSAGE_SIZE - 1)
+			size = MAX_MESSAGE_SIZE - 1;
+		memcpy(req->input, slot->data, size);
+		req->input[size] = '\0';
+		req->length = size;
+		shm_store(&segment->requests.head, head + 1);
+
+		if (size < sizeof(tfs_header) || (unsigned char) req->input[0] != TFS_MAGIC) {
+			/* only the binary format has a reply that fits the ring */
+			tfs_reply error = { TFS_MAGIC, TFS_VERSION, 0, 0, 0, FAIL };
+			memcpy(reply, &error, sizeof(error));
+		}
+		else
+			replySize = session->handler(req, reply);
+
+		/* a pipelining client may not be reading its replies yet */
+		uint32_t tail = segment->replies.tail.value;
+		while (tail - shm_load(&segment->replies.head) >= SHM_RING_SLOTS) {
+			if (shm_client_gone(segment))
+				goto end;
+			sched_yield();
+		}
+		memcpy(&segment->reply[tail % SHM_RING_SLOTS], reply, replySize);
+		shm_publish(&segment->replies);
+	}
+
+end:
+	/* the epoch record of the thread can be taken by the thread of a later session */
+	ebr_unregister();
+	munmap(segment, sizeof(shm_segment));
+	free(session);
+	shm_session_end();
+	return NULL;
+}
+
+/**
+ * Maps the segment created by a client and starts serving it.
+ * @param name: name of the segment (shm_open)
+ * @param handler: function that executes each request
+ * @return SUCCESS or FAIL
+*/
+int shm_session_open(char *name, shm_handler handler) {
+	int fd;
+	pthread_t tid;
+	pthread_attr_t attr;
+	shm_segment *segment;
+	shm_session *session;
+	struct stat st;
+
+	if (__atomic_add_fetch(&shm_sessions, 1, __ATOMIC_SEQ_CST) > MAX_SHM_SESSIONS ||
+			__atomic_load_n(&shm_closing, __ATOMIC_SEQ_CST)) {
+		shm_session_end();
+		return FAIL;
+	}
+
+	/* a segment smaller than expected would fault when accessed */
+	if ((fd = shm_open(name, O_RDWR, 0)) < 0 || fstat(fd, &st) < 0 || st.st_size < sizeof(shm_segment)) {
+		if (fd >= 0)
+			close(fd);
+		shm_session_end();
+		return FAIL;
+	}
+	segment = mmap(NULL, sizeof(shm_segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (segment == MAP_FAILED || segment->magic != SHM_MAGIC) {
+		if (segment != MAP_FAILED)
+			munmap(segment, sizeof(shm_segment));
+		shm_session_end();
+		return FAIL;
+	}
+	segment->server_pid = getpid();
+
+	session = (shm_session *) malloc(sizeof(shm_session));
+	session->segment = segment;
+	session->handler = handler;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&tid, &attr, shm_session_loop, session) != 0) {
+		munmap(segment, sizeof(shm_segment));
+		free(session);
+		shm_session_end();
+		pthread_attr_destroy(&attr);
+		return FAIL;
+	}
+	pthread_attr_destroy(&attr);
+	return SUCCESS;
+}
+
+/**
+ * Refuses new sessions and waits for the threads of the open ones to end,
+ * which happens within the timeout of their wait for requests.
+*/
+void shm_close_sessions() {
+	__atomic_store_n(&shm_closing, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_lock(&shm_mutex);
+	while (__atomic_load_n(&shm_sessions, __ATOMIC_SEQ_CST) > 0)
+		pthread_cond_wait(&shm_ended, &shm_mutex);
+	pthread_mutex_unlock(&shm_mutex);
+}
@@ -0,0 +1,18 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include "tecnicofs-shm.h"
+#include "queue.h"
+
+#define MAX_SHM_SESSIONS 64
+
+/*
+ * Executes a request copied out of a segment and writes its reply, returning
+ * the size of the reply
+ */
+typedef int (*shm_handler)(request *req, char *reply);
+
+int shm_session_open(char *name, shm_handler handler);
+void shm_close_sessions();
+
+#endif /* SHM_H */
@@ -0,0 +1,85 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "stats.h"
+
+server_stats stats;
+
+/**
+ * Starts the wall clock the statistics are relative to.
+*/
+void stats_init() {
+	clock_gettime(CLOCK_MONOTONIC, &stats.start);
+}
+
+/**
+ * Returns the nanoseconds elapsed since a given instant.
+ * @param since: instant taken with CLOCK_MONOTONIC
+*/
+long stats_elapsed(struct timespec *since) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - since->tv_sec) * 1000000000L + (now.tv_nsec - since->tv_nsec);
+}
+
+/**
+ * Adds a value to a counter shared by every thread.
+ * @param counter: counter inside stats
+ * @param value: value to add
+*/
+void stats_add(long *counter, long value) {
+	__atomic_add_fetch(counter, value, __ATOMIC_RELAXED);
+}
+
+/**
+ * Accounts for a request that was just replied.
+ * @param received: instant when the request was received
+*/
+void stats_request(struct timespec *received) {
+	long latency = stats_elapsed(received);
+	long max = __atomic_load_n(&stats.latency_max, __ATOMIC_RELAXED);
+
+	stats_add(&stats.requests, 1);
+	stats_add(&stats.latency_total, latency);
+	while (latency > max && !__atomic_compare_exchange_n(&stats.latency_max, &max, latency,
+			0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/**
+ * Prints the counters, the CPU time used and the time the CPUs were idle.
+ * Context switches are taken from getrusage, voluntary ones being the times
+ * a thread blocked and was woken up again.
+ * @param fp: file where the statistics are printed
+*/
+void stats_print(FILE *fp) {
+	struct rusage usage;
+	long requests = __atomic_load_n(&stats.requests, __ATOMIC_RELAXED);
+	double wall = stats_elapsed(&stats.start) / 1e9;
+	double cpu, available = wall * sysconf(_SC_NPROCESSORS_ONLN);
+
+	getrusage(RUSAGE_SELF, &usage);
+	cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+		usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+
+	fprintf(fp, "requests: %ld\n", requests);
+	fprintf(fp, "latency (us): avg %.2f max %.2f\n",
+		requests ? stats.latency_total / 1e3 / requests : 0.0, stats.latency_max / 1e3);
+	fprintf(fp, "wall (s): %.2f cpu (s): %.2f idle cpu: %.1f%%\n",
+		wall, cpu, available > 0 ? 100 * (available - cpu) / available : 0.0);
+	fprintf(fp, "requests per cpu second: %.0f\n", cpu > 0 ? requests / cpu : 0.0);
+	fprintf(fp, "context switches: voluntary %ld involuntary %ld\n", usage.ru_nvcsw, usage.ru_nivcsw);
+	fprintf(fp, "wakeups: io %ld workers %ld\n", stats.io_wakeups, stats.worker_wakeups);
+	fprintf(fp, "syscalls: %ld (%.2f per request)\n", stats.syscalls,
+		requests ? (double) stats.syscalls / requests : 0.0);
+	fprintf(fp, "coalesced lookups: %ld of %ld (%.1f%%)\n", stats.coalesced, stats.lookups,
+		stats.lookups ? 100.0 * stats.coalesced / stats.lookups : 0.0);
+	fprintf(fp, "leases: granted %ld refused %ld, mutations waiting for leases: %ld\n",
+		stats.leases, stats.leases_refused, stats.lease_waits);
+	fprintf(fp, "rejected:");
+	for (int c = 0; c < NUM_CLASSES; c++)
+		fprintf(fp, " %s %ld", class_names[c], stats.rejected[c]);
+	fprintf(fp, "\n");
+	fflush(fp);
+}
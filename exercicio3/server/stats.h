@@ -0,0 +1,35 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <time.h>
+#include "queue.h"
+
+/*
+ * Server counters, updated by every thread and printed on SIGUSR1 or on exit
+ */
+typedef struct server_stats {
+	long requests;
+	long latency_total;    /* nanoseconds from receiving a request to replying */
+	long latency_max;
+	long io_wakeups;       /* returns of epoll_wait in the I/O thread, or of io_uring_enter */
+	long worker_wakeups;   /* workers woken up by the request queue */
+	long syscalls;         /* socket syscalls made to receive and reply */
+	long lookups;
+	long coalesced;        /* lookups answered with the result of an identical one in flight */
+	long leases;           /* leases granted on lookups */
+	long leases_refused;   /* leases refused during a delete or move of the path */
+	long lease_waits;      /* deletes and moves that waited for leases to expire */
+	long rejected[NUM_CLASSES];   /* requests rejected because their queue was full */
+	struct timespec start;
+} server_stats;
+
+extern server_stats stats;
+
+void stats_init();
+long stats_elapsed(struct timespec *since);
+void stats_request(struct timespec *received);
+void stats_add(long *counter, long value);
+void stats_print(FILE *fp);
+
+#endif /* STATS_H */
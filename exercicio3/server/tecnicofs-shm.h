@@ -0,0 +1,117 @@
+/* tecnicofs-shm.h */
+#ifndef TECNICOFS_SHM_H
+#define TECNICOFS_SHM_H
+
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include "tecnicofs-api-constants.h"
+#include "tecnicofs-protocol.h"
+
+/*
+ * Shared memory transport.
+ * The client creates a segment with a request ring, written by the client
+ * and read by the server, and a reply ring, written by the server and read by
+ * the client. Each ring has a single producer and a single consumer: the
+ * producer only writes the tail, the consumer only writes the head. A consumer
+ * with nothing to read spins for a while and then sleeps on a futex over the
+ * tail, after setting its waiting flag so that the producer wakes it up.
+ * The segment is negotiated at tfsMount with a TFS_OP_MOUNT request carrying
+ * its name, the server maps it and serves it with a dedicated thread.
+ */
+#define SHM_MAGIC 0x54465348
+#define SHM_RING_SLOTS 8            /* power of two */
+#define SHM_SPIN 2000               /* iterations before sleeping, with more than one CPU */
+#define SHM_CACHE_LINE 64
+
+/*
+ * Ring index, alone in its cache line
+ */
+typedef struct shm_index {
+	uint32_t value;
+} __attribute__((aligned(SHM_CACHE_LINE))) shm_index;
+
+typedef struct shm_ring {
+	shm_index head;             /* messages consumed */
+	shm_index tail;             /* messages produced, futex word */
+	shm_index waiting;          /* set while the consumer sleeps */
+} shm_ring;
+
+typedef struct shm_slot {
+	uint32_t size;
+	char data[MAX_MESSAGE_SIZE + 1];    /* room for a '\0' after the message */
+} shm_slot;
+
+typedef struct shm_segment {
+	uint32_t magic;
+	int32_t client_pid;
+	int32_t server_pid;
+	uint32_t closed;            /* set by the client at tfsUnmount */
+	shm_ring requests;
+	shm_ring replies;
+	shm_slot request[SHM_RING_SLOTS];
+	tfs_batch_reply reply[SHM_RING_SLOTS];
+} shm_segment;
+
+static inline void shm_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+	__asm__ volatile("pause");
+#endif
+}
+
+static inline uint32_t shm_load(shm_index *index) {
+	return __atomic_load_n(&index->value, __ATOMIC_SEQ_CST);
+}
+
+static inline void shm_store(shm_index *index, uint32_t value) {
+	__atomic_store_n(&index->value, value, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Publishes the next message of a ring, waking the consumer if it sleeps.
+ * @param ring: ring written by the caller
+*/
+static inline void shm_publish(shm_ring *ring) {
+	shm_store(&ring->tail, shm_load(&ring->tail) + 1);
+	if (shm_load(&ring->waiting))
+		syscall(SYS_futex, &ring->tail.value, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+/**
+ * Waits until a ring has a message to consume, spinning first and then
+ * sleeping on the futex. Sleeps are bounded so that the caller can check
+ * whether the other process is still alive.
+ * @param ring: ring read by the caller
+ * @param spin: iterations to spin before sleeping
+ * @param timeout: longest sleep
+ * @return 1 if there is a message, 0 if the timeout expired
+*/
+static inline int shm_wait(shm_ring *ring, int spin, struct timespec *timeout) {
+	uint32_t head = ring->head.value;
+	uint32_t tail;
+
+	for (int i = 0; i < spin; i++) {
+		if (shm_load(&ring->tail) != head)
+			return 1;
+		shm_relax();
+	}
+
+	shm_store(&ring->waiting, 1);
+	/* the producer either sees the flag or its message is seen here */
+	if ((tail = shm_load(&ring->tail)) == head)
+		syscall(SYS_futex, &ring->tail.value, FUTEX_WAIT, tail, timeout, NULL, 0);
+	shm_store(&ring->waiting, 0);
+	return shm_load(&ring->tail) != head;
+}
+
+/**
+ * Number of iterations to spin: spinning only helps when the other process
+ * can run at the same time.
+*/
+static inline int shm_spin() {
+	return sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SHM_SPIN : 0;
+}
+
+#endif /* TECNICOFS_SHM_H */
@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+#include "fs/state.h"
+
+/*
+ * There is no liburing, the rings are set up and driven with the raw
+ * syscalls and the memory layout exported by <linux/io_uring.h>.
+ */
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *params) {
+	return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+	return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+	return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/**
+ * Maps the submission and completion rings of a new io_uring instance.
+ * @param ring: ring to initialize
+ * @param params: parameters returned by io_uring_setup
+ * @return SUCCESS or FAIL
+*/
+static int uring_map(uring *ring, struct io_uring_params *params) {
+	ring->sq_ring_size = params->sq_off.array + params->sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = params->cq_off.cqes + params->cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_size = params->sq_entries * sizeof(struct io_uring_sqe);
+
+	/* newer kernels map both rings at once */
+	if (params->features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_ring_size > ring->sq_ring_size)
+			ring->sq_ring_size = ring->cq_ring_size;
+		ring->cq_ring_size = ring->sq_ring_size;
+	}
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED)
+		return FAIL;
+
+	if (params->features & IORING_FEAT_SINGLE_MMAP)
+		ring->cq_ring = ring->sq_ring;
+	else {
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_ring == MAP_FAILED)
+			return FAIL;
+	}
+
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED)
+		return FAIL;
+
+	char *sq = (char *) ring->sq_ring, *cq = (char *) ring->cq_ring;
+	ring->sq_head = (unsigned *) (sq + params->sq_off.head);
+	ring->sq_tail = (unsigned *) (sq + params->sq_off.tail);
+	ring->sq_mask = (unsigned *) (sq + params->sq_off.ring_mask);
+	ring->sq_array = (unsigned *) (sq + params->sq_off.array);
+	ring->cq_head = (unsigned *) (cq + params->cq_off.head);
+	ring->cq_tail = (unsigned *) (cq + params->cq_off.tail);
+	ring->cq_mask = (unsigned *) (cq + params->cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *) (cq + params->cq_off.cqes);
+
+	/* entry i of the submission queue is always sqes[i] */
+	for (unsigned i = 0; i < params->sq_entries; i++)
+		ring->sq_array[i] = i;
+	ring->sq_local_tail = *ring->sq_tail;
+	return SUCCESS;
+}
+
+/**
+ * Registers the ring of buffers completed receives are written to and gives
+ * every buffer to the kernel.
+ * @param ring: ring
+ * @param buffer_size: size of each buffer
+ * @return SUCCESS or FAIL
+*/
+static int uring_provide_buffers(uring *ring, unsigned buffer_size) {
+	struct io_uring_buf_reg reg;
+
+	/* the buffer ring must be page aligned */
+	ring->buffers = mmap(NULL, URING_BUFFERS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ring->buffers == MAP_FAILED) {
+		ring->buffers = NULL;
+		return FAIL;
+	}
+	ring->buffer_size = buffer_size;
+	if ((ring->buffer_data = malloc((size_t) URING_BUFFERS * buffer_size)) == NULL)
+		return FAIL;
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (unsigned long) ring->buffers;
+	reg.ring_entries = URING_BUFFERS;
+	reg.bgid = URING_BUFFER_GROUP;
+	if (sys_io_uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+		return FAIL;
+
+	ring->buffers->tail = 0;
+	for (unsigned bid = 0; bid < URING_BUFFERS; bid++)
+		uring_recycle_buffer(ring, bid);
+	return SUCCESS;
+}
+
+/**
+ * Sets up an io_uring instance for the calling thread and its provided
+ * buffers. The ring must only be used by this thread.
+ * @param ring: ring to initialize
+ * @param buffer_size: size of each provided buffer
+ * @return SUCCESS or FAIL, with errno set, if io_uring is not available
+*/
+int uring_init(uring *ring, unsigned buffer_size) {
+	struct io_uring_params params;
+
+	memset(ring, 0, sizeof(uring));
+
+	/* completions run when the owner enters the ring instead of interrupting it */
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+	if ((ring->fd = sys_io_uring_setup(URING_ENTRIES, &params)) < 0 && errno == EINVAL) {
+		memset(&params, 0, sizeof(params));
+		ring->fd = sys_io_uring_setup(URING_ENTRIES, &params);
+	}
+	if (ring->fd < 0)
+		return FAIL;
+
+	if (uring_map(ring, &params) == FAIL || uring_provide_buffers(ring, buffer_size) == FAIL) {
+		int error = errno;
+		uring_destroy(ring);
+		errno = error;
+		return FAIL;
+	}
+	return SUCCESS;
+}
+
+/**
+ * Unmaps the rings and releases the buffers of an io_uring instance.
+ * @param ring: ring
+*/
+void uring_destroy(uring *ring) {
+	if (ring->sqes != NULL && ring->sqes != MAP_FAILED)
+		munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring != NULL && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	if (ring->sq_ring != NULL && ring->sq_ring != MAP_FAILED)
+		munmap(ring->sq_ring, ring->sq_ring_size);
+	if (ring->buffers != NULL)
+		munmap(ring->buffers, URING_BUFFERS * sizeof(struct io_uring_buf));
+	free(ring->buffer_data);
+	if (ring->fd >= 0)
+		close(ring->fd);
+	memset(ring, 0, sizeof(uring));
+	ring->fd = -1;
+}
+
+/**
+ * Checks whether the kernel supports everything the io_uring backend uses:
+ * provided buffer rings and multishot recvmsg on a datagram socket.
+ * @return SUCCESS or FAIL
+*/
+int uring_probe() {
+	uring ring;
+	int fds[2], result = FAIL;
+	struct msghdr msg;
+	struct io_uring_cqe *cqe;
+	struct io_uring_sqe *sqe;
+
+	if (socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) < 0)
+		return FAIL;
+	if (uring_init(&ring, 256) == FAIL) {
+		close(fds[0]);
+		close(fds[1]);
+		return FAIL;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	sqe = uring_get_sqe(&ring);
+	uring_prep_recvmsg_multishot(sqe, fds[0], &msg);
+	if (uring_submit_and_wait(&ring, 0) >= 0 && send(fds[1], "", 1, 0) == 1 &&
+			uring_submit_and_wait(&ring, 1) >= 0 && (cqe = uring_peek_cqe(&ring)) != NULL) {
+		/* the receive picked a buffer and stays armed */
+		if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER) && (cqe->flags & IORING_CQE_F_MORE))
+			result = SUCCESS;
+		uring_cqe_seen(&ring);
+	}
+	if (result == FAIL)
+		errno = EOPNOTSUPP;
+
+	uring_destroy(&ring);
+	close(fds[0]);
+	close(fds[1]);
+	return result;
+}
+
+/**
+ * Returns the next free submission queue entry, cleared, or NULL if every
+ * entry is waiting to be submitted.
+ * @param ring: ring
+*/
+struct io_uring_sqe *uring_get_sqe(uring *ring) {
+	unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	struct io_uring_sqe *sqe;
+
+	if (ring->sq_local_tail - head >= *ring->sq_mask + 1)
+		return NULL;
+	sqe = &ring->sqes[ring->sq_local_tail & *ring->sq_mask];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	ring->sq_local_tail++;
+	ring->to_submit++;
+	return sqe;
+}
+
+/**
+ * Submits the entries filled since the last call and waits for completions,
+ * all in a single io_uring_enter.
+ * @param ring: ring
+ * @param wait: completions to wait for
+ * @return entries submitted, or FAIL
+*/
+int uring_submit_and_wait(uring *ring, unsigned wait) {
+	int submitted;
+
+	__atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+	if ((submitted = sys_io_uring_enter(ring->fd, ring->to_submit, wait, IORING_ENTER_GETEVENTS)) < 0)
+		return errno == EINTR ? 0 : FAIL;
+	ring->to_submit -= submitted;
+	return submitted;
+}
+
+/**
+ * Returns the oldest completion not yet seen, or NULL if there is none.
+ * @param ring: ring
+*/
+struct io_uring_cqe *uring_peek_cqe(uring *ring) {
+	unsigned head = *ring->cq_head;
+
+	if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+		return NULL;
+	return &ring->cqes[head & *ring->cq_mask];
+}
+
+/**
+ * Gives the completion returned by uring_peek_cqe back to the kernel.
+ * @param ring: ring
+*/
+void uring_cqe_seen(uring *ring) {
+	__atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Returns a provided buffer.
+ * @param ring: ring
+ * @param bid: buffer id, taken from the flags of a completion
+*/
+char *uring_buffer(uring *ring, unsigned bid) {
+	return ring->buffer_data + (size_t) bid * ring->buffer_size;
+}
+
+/**
+ * Gives a buffer back to the kernel once its request was executed.
+ * @param ring: ring
+ * @param bid: buffer id
+*/
+void uring_recycle_buffer(uring *ring, unsigned bid) {
+	unsigned short tail = ring->buffers->tail;
+	struct io_uring_buf *buf = &ring->buffers->bufs[tail & (URING_BUFFERS - 1)];
+
+	/* the tail shares its cache line with the first entry, which is not overwritten whole */
+	buf->addr = (unsigned long) uring_buffer(ring, bid);
+	buf->len = ring->buffer_size;
+	buf->bid = bid;
+	__atomic_store_n(&ring->buffers->tail, (unsigned short) (tail + 1), __ATOMIC_RELEASE);
+}
+
+/**
+ * Prepares a multishot recvmsg: every datagram received completes with a
+ * provided buffer holding a struct io_uring_recvmsg_out, the address of the
+ * sender and the message, and the receive stays armed.
+ * @param sqe: submission queue entry
+ * @param fd: socket
+ * @param msg: msg_namelen and msg_controllen set the room for the address
+ *             and control data in each buffer
+*/
+void uring_prep_recvmsg_multishot(struct io_uring_sqe *sqe, int fd, struct msghdr *msg) {
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long) msg;
+	sqe->len = 1;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BUFFER_GROUP;
+}
+
+/**
+ * Prepares a sendmsg. The message must stay valid until it completes.
+ * @param sqe: submission queue entry
+ * @param fd: socket
+ * @param msg: message
+ * @param flags: flags of sendmsg, MSG_DONTWAIT completes with -EAGAIN
+ *               instead of being retried by the kernel
+*/
+void uring_prep_sendmsg(struct io_uring_sqe *sqe, int fd, struct msghdr *msg, int flags) {
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long) msg;
+	sqe->len = 1;
+	sqe->msg_flags = flags;
+}
+
+/**
+ * Prepares a poll that completes once a file is ready, used to wake the
+ * thread of a ring from another thread.
+ * @param sqe: submission queue entry
+ * @param fd: file
+ * @param events: poll events, such as POLLIN
+*/
+void uring_prep_poll_add(struct io_uring_sqe *sqe, int fd, unsigned events) {
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = events;
+}
+
+/**
+ * Prepares the cancellation of the requests with the given user_data, a
+ * multishot receive then completes without IORING_CQE_F_MORE.
+ * @param sqe: submission queue entry
+ * @param user_data: user_data of the requests to cancel
+*/
+void uring_prep_cancel(struct io_uring_sqe *sqe, __u64 user_data) {
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = user_data;
+}
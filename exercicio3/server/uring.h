@@ -0,0 +1,44 @@
+#ifndef URING_H
+#define URING_H
+
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+#define URING_ENTRIES 256     /* submission queue entries of each ring */
+#define URING_BUFFERS 32      /* buffers provided to the kernel, a power of two */
+#define URING_BUFFER_GROUP 0
+
+/*
+ * io_uring instance owned by a single thread, set up with the raw syscalls,
+ * and the ring of buffers the kernel picks from when a receive completes
+ */
+typedef struct uring {
+	int fd;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size, sqes_size;
+	unsigned sq_local_tail;   /* entries filled but not yet published */
+	unsigned to_submit;
+	struct io_uring_buf_ring *buffers;
+	char *buffer_data;
+	unsigned buffer_size;
+} uring;
+
+int uring_init(uring *ring, unsigned buffer_size);
+void uring_destroy(uring *ring);
+int uring_probe();
+struct io_uring_sqe *uring_get_sqe(uring *ring);
+int uring_submit_and_wait(uring *ring, unsigned wait);
+struct io_uring_cqe *uring_peek_cqe(uring *ring);
+void uring_cqe_seen(uring *ring);
+char *uring_buffer(uring *ring, unsigned bid);
+void uring_recycle_buffer(uring *ring, unsigned bid);
+void uring_prep_recvmsg_multishot(struct io_uring_sqe *sqe, int fd, struct msghdr *msg);
+void uring_prep_sendmsg(struct io_uring_sqe *sqe, int fd, struct msghdr *msg, int flags);
+void uring_prep_poll_add(struct io_uring_sqe *sqe, int fd, unsigned events);
+void uring_prep_cancel(struct io_uring_sqe *sqe, __u64 user_data);
+
+#endif /* URING_H */